@@ -0,0 +1,310 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+"""Host side reader for the uart0 binary telemetry/control stream.
+
+Decodes COBS framed, CRC-16/CCITT-FALSE protected frames sent by the reader
+firmware (CONFIG_APP_UART_STREAM) and can send allowlist/configuration
+commands. See src/uart_stream.h for the frame layout.
+
+Examples:
+    uart_stream_reader.py /dev/ttyACM0
+    uart_stream_reader.py /dev/ttyACM0 --add-addr fe:4f:c7:53:20:fd/random
+    uart_stream_reader.py /dev/ttyACM0 --light-timeout 120 --stats 5
+    uart_stream_reader.py /dev/ttyACM0 --set-time --rules rules.json \
+        --add-addr fe:4f:c7:53:20:fd/random@1 --resync
+
+The rules file lists week schedules, groups and holidays:
+
+    {
+        "schedules": {"0": [{"days": ["mon", "tue", "wed", "thu", "fri"],
+                             "start": "07:00", "end": "19:00"}]},
+        "groups": {"1": {"schedule": 0, "doors": [0, 1]}},
+        "holidays": ["2026-12-25"]
+    }
+"""
+
+import argparse
+import binascii
+import datetime
+import json
+import struct
+import sys
+import time
+
+import serial
+
+EVT_PRESENCE = 0x01
+EVT_AUTH_STAGE = 0x02
+EVT_OUTPUT = 0x03
+EVT_STATS = 0x04
+EVT_ACK = 0x05
+EVT_BOOT_TIMING = 0x06
+
+CMD_PING = 0x80
+CMD_ADD_ADDR = 0x81
+CMD_SET_LIGHT_TIMEOUT = 0x82
+CMD_RULES_BEGIN = 0x83
+CMD_RULES_SCHEDULE = 0x84
+CMD_RULES_GROUP = 0x85
+CMD_RULES_HOLIDAY = 0x86
+CMD_RULES_COMMIT = 0x87
+CMD_SET_TIME = 0x88
+CMD_REMOVE_ADDR = 0x89
+CMD_CLEAR_ADDRS = 0x8a
+
+HDR = struct.Struct("<BHI")
+
+AUTH_STAGES = ["connect", "primary", "write_chrc", "read_chrc", "read_ccc", "notify"]
+OUTPUTS = ["overhead", "led", "authenticated", "auth_fail"]
+BOOT_MILESTONES = ["inputs_ready", "outputs_ready", "bt_ready", "first_scan",
+                   "first_allowlist_entry", "allowlist_loaded", "rules_ready", "first_possible_unlock"]
+ADDR_TYPES = {"public": 0, "random": 1}
+RULE_DAYS = ["mon", "tue", "wed", "thu", "fri", "sat", "sun", "holiday"]
+EPOCH = datetime.date(1970, 1, 1)
+
+
+def crc16(data):
+    return binascii.crc_hqx(data, 0xFFFF)
+
+
+def cobs_encode(data):
+    out = bytearray([0])
+    code_idx = 0
+    code = 1
+    for b in data:
+        if b == 0:
+            out[code_idx] = code
+            code_idx = len(out)
+            out.append(0)
+            code = 1
+            continue
+        out.append(b)
+        code += 1
+        if code == 0xFF:
+            out[code_idx] = code
+            code_idx = len(out)
+            out.append(0)
+            code = 1
+    out[code_idx] = code
+    return bytes(out)
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        i += 1
+        if code == 0 or i + code - 1 > len(data):
+            raise ValueError("bad COBS frame")
+        out += data[i:i + code - 1]
+        i += code - 1
+        if code != 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def build_frame(ftype, seq, payload=b""):
+    frame = HDR.pack(ftype, seq & 0xFFFF, 0) + payload
+    frame += struct.pack("<H", crc16(frame))
+    return cobs_encode(frame) + b"\x00"
+
+
+def parse_addr(text):
+    text, _, group = text.partition("@")
+    addr, _, kind = text.partition("/")
+    val = bytes(int(x, 16) for x in reversed(addr.split(":")))
+    if len(val) != 6:
+        raise argparse.ArgumentTypeError("address must be 6 bytes")
+    payload = bytes([ADDR_TYPES.get(kind or "public", 0)]) + val
+    if group:
+        payload += bytes([int(group)])
+    return payload
+
+
+def parse_quarter(text):
+    hours, _, minutes = text.partition(":")
+    return (int(hours) * 60 + int(minutes or 0)) // 15
+
+
+def parse_day(text):
+    return (datetime.date.fromisoformat(text) - EPOCH).days
+
+
+def rules_frames(rules):
+    """Return (command, payload) pairs that load and commit a rule set."""
+    holidays = [parse_day(day) for day in rules.get("holidays", [])]
+    base = min(holidays) if holidays else 0
+    frames = [(CMD_RULES_BEGIN, struct.pack("<H", base))]
+    for sched, ranges in rules.get("schedules", {}).items():
+        for rng in ranges:
+            mask = 0
+            for day in rng["days"]:
+                mask |= 1 << RULE_DAYS.index(day)
+            frames.append((CMD_RULES_SCHEDULE, struct.pack(
+                "<BBBB", int(sched), mask, parse_quarter(rng["start"]), parse_quarter(rng["end"]))))
+    for group, cfg in rules.get("groups", {}).items():
+        doors = 0
+        for door in cfg["doors"]:
+            doors |= 1 << door
+        frames.append((CMD_RULES_GROUP, struct.pack("<BBI", int(group), cfg["schedule"], doors)))
+    for day in holidays:
+        frames.append((CMD_RULES_HOLIDAY, struct.pack("<H", day)))
+    frames.append((CMD_RULES_COMMIT, b""))
+    return frames
+
+
+def local_seconds():
+    now = time.time()
+    return int(now + datetime.datetime.fromtimestamp(now).astimezone().utcoffset().total_seconds())
+
+
+def format_addr(payload):
+    kind = "random" if payload[0] else "public"
+    return ":".join("%02X" % b for b in reversed(payload[1:7])) + "/" + kind
+
+
+def format_event(ftype, payload):
+    if ftype == EVT_PRESENCE:
+        rssi = struct.unpack_from("<b", payload, 7)[0]
+        return "presence %s rssi %d" % (format_addr(payload), rssi)
+    if ftype == EVT_AUTH_STAGE:
+        stage, duration, err = struct.unpack("<BIh", payload)
+        name = AUTH_STAGES[stage] if stage < len(AUTH_STAGES) else str(stage)
+        return "auth %s %d ms err %d" % (name, duration, err)
+    if ftype == EVT_OUTPUT:
+        door, out, state = payload[0], payload[1], payload[2]
+        name = OUTPUTS[out] if out < len(OUTPUTS) else str(out)
+        return "output door %d %s %d" % (door, name, state)
+    if ftype == EVT_STATS:
+        tx, dropped, rx, rx_err = struct.unpack("<IIII", payload)
+        return "stats tx %d dropped %d rx %d rx_errors %d" % (tx, dropped, rx, rx_err)
+    if ftype == EVT_ACK:
+        cmd, seq, res = struct.unpack("<BHh", payload)
+        return "ack cmd 0x%02x seq %d result %d" % (cmd, seq, res)
+    if ftype == EVT_BOOT_TIMING:
+        milestone, uptime = struct.unpack("<BI", payload)
+        name = BOOT_MILESTONES[milestone] if milestone < len(BOOT_MILESTONES) else str(milestone)
+        return "boot %s %d ms" % (name, uptime)
+    return "type 0x%02x %s" % (ftype, payload.hex())
+
+
+class Reader:
+    def __init__(self, port, quiet, on_boot=None):
+        self.port = port
+        self.quiet = quiet
+        self.on_boot = on_boot
+        self.buf = bytearray()
+        self.last_seq = None
+        self.frames = 0
+        self.lost = 0
+        self.errors = 0
+
+    def handle(self, raw):
+        try:
+            frame = cobs_decode(raw)
+        except ValueError:
+            self.errors += 1
+            return
+        if len(frame) < HDR.size + 2 or crc16(frame[:-2]) != struct.unpack("<H", frame[-2:])[0]:
+            self.errors += 1
+            return
+
+        ftype, seq, ts = HDR.unpack_from(frame)
+        if self.last_seq is not None:
+            self.lost += (seq - self.last_seq - 1) & 0xFFFF
+        self.last_seq = seq
+        self.frames += 1
+
+        if not self.quiet:
+            print("%10d.%03d #%5d %s" % (ts // 1000, ts % 1000, seq,
+                                        format_event(ftype, frame[HDR.size:-2])))
+        # the first milestone of a boot, the reader has just reset
+        if ftype == EVT_BOOT_TIMING and frame[HDR.size] == 0 and self.on_boot:
+            self.on_boot()
+
+    def poll(self):
+        data = self.port.read(self.port.in_waiting or 1)
+        self.buf += data
+        while True:
+            end = self.buf.find(b"\x00")
+            if end < 0:
+                break
+            raw = bytes(self.buf[:end])
+            del self.buf[:end + 1]
+            if raw:
+                self.handle(raw)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port")
+    parser.add_argument("-b", "--baudrate", type=int, default=115200)
+    parser.add_argument("--add-addr", type=parse_addr, action="append", default=[],
+                        metavar="AA:BB:CC:DD:EE:FF[/random][@GROUP]")
+    parser.add_argument("--remove-addr", type=parse_addr, action="append", default=[],
+                        metavar="AA:BB:CC:DD:EE:FF[/random]")
+    parser.add_argument("--clear-addrs", action="store_true", help="remove every address from the allowlist")
+    parser.add_argument("--light-timeout", type=int, metavar="SECONDS")
+    parser.add_argument("--set-time", action="store_true", help="set the reader clock to host local time")
+    parser.add_argument("--rules", type=argparse.FileType("r"), metavar="FILE",
+                        help="load and commit the access rules in a JSON file")
+    parser.add_argument("--stats", type=float, metavar="INTERVAL",
+                        help="print host side rate/loss and ping the reader every INTERVAL s")
+    parser.add_argument("--resync", action="store_true",
+                        help="send the time, rules and addresses again whenever the reader resets")
+    parser.add_argument("-q", "--quiet", action="store_true", help="do not print each event")
+    args = parser.parse_args()
+
+    port = serial.Serial(args.port, args.baudrate, timeout=0.1)
+    rules = json.load(args.rules) if args.rules else None
+    seq = 0
+
+    def send(cmd, payload=b""):
+        nonlocal seq
+        port.write(build_frame(cmd, seq, payload))
+        seq += 1
+
+    def send_config():
+        # rules and clock live in RAM on the reader, as do added addresses
+        if args.set_time:
+            send(CMD_SET_TIME, struct.pack("<I", local_seconds()))
+        if rules:
+            for cmd, payload in rules_frames(rules):
+                send(cmd, payload)
+                # pace the frames, the reader queues only a few commands
+                time.sleep(0.01)
+        if args.clear_addrs:
+            send(CMD_CLEAR_ADDRS)
+        for addr in args.remove_addr:
+            send(CMD_REMOVE_ADDR, addr[:7])
+        for addr in args.add_addr:
+            send(CMD_ADD_ADDR, addr)
+        if args.light_timeout is not None:
+            send(CMD_SET_LIGHT_TIMEOUT, struct.pack("<H", args.light_timeout))
+
+    reader = Reader(port, args.quiet, send_config if args.resync else None)
+    send_config()
+
+    start = last = time.monotonic()
+    frames_at_last = 0
+    try:
+        while True:
+            reader.poll()
+            now = time.monotonic()
+            if args.stats and now - last >= args.stats:
+                rate = (reader.frames - frames_at_last) / (now - last)
+                print("host: %.1f frames/s, %d frames, %d lost, %d bad" %
+                      (rate, reader.frames, reader.lost, reader.errors), file=sys.stderr)
+                send(CMD_PING)
+                frames_at_last = reader.frames
+                last = now
+    except KeyboardInterrupt:
+        elapsed = time.monotonic() - start
+        print("host: %d frames in %.1f s, %d lost, %d bad" %
+              (reader.frames, elapsed, reader.lost, reader.errors), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
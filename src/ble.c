@@ -8,6 +8,7 @@
 
 #include "ble.h"
 
+#include <zephyr/init.h>
 #include <zephyr/bluetooth/bluetooth.h>
 #include <zephyr/bluetooth/conn.h>
 #include <zephyr/bluetooth/uuid.h>
@@ -22,18 +23,45 @@ LOG_MODULE_REGISTER(BLE);
 #define AUTH_EVT_NOTIFICATIONS_ENABLED		0x10
 #define AUTH_EVT_ATTR_DISCOVER_FAIL			0x20
 
+#define AUTH_STAGE_TIMEOUT_MS				5000
+// Retry a stage timeout that found the BLE control queue full
+#define AUTH_TIMEOUT_RETRY_MS				10
+
+// Main, GATT callbacks, timers, allowlist loading and the uart stream all post
+#define BLE_MSGQ_LEN						16
+
+// Allowlist entries loaded per BLE control message while scanning
+#define ALLOWLIST_LOAD_CHUNK				8
+// Retry queueing the next chunk when the BLE control queue is full
+#define ALLOWLIST_LOAD_RETRY_MS				20
+
+// Connection interval 50 ms (1.25 ms units)
+#define CONN_INTERVAL						40
+// Idle: scan continuously, 60 ms interval and window (0.625 ms units)
+#define SCAN_IDLE_INTERVAL					0x0060
+#define SCAN_IDLE_WINDOW					0x0060
+// Connected: window of half a connection interval every two connection
+// intervals (1.25 ms units -> 0.625 ms units), 25 ms every 100 ms at 50 ms
+#define SCAN_CONNECTED_INTERVAL(conn_interval)	((conn_interval) * 4)
+#define SCAN_CONNECTED_WINDOW(conn_interval)	(conn_interval)
+
+// A tag seen this recently is connected to as soon as authentication is enabled
+#define WAITING_TAG_TIMEOUT_MS				2000
+
+#define SCAN_WATCHDOG_PERIOD_MS				2000
+
 #define MAIN_SERVICE_UUID 	BT_UUID_DECLARE_16(0xfea0)
 #define WRITE_CHRC			BT_UUID_DECLARE_16(0xfea1)
 #define READ_CHRC			BT_UUID_DECLARE_16(0xfea2)
 
-bt_addr_le_t test_address1 = {
-	.type = BT_ADDR_LE_RANDOM,
-	.a.val={0xfd, 0x20, 0x53, 0xc7, 0x4f, 0xfe},
-};
+// hash index over the filter entries, at most half full so probes stay short
+#define ADDR_FILTER_SLOTS					(2 * CONFIG_APP_ALLOWLIST_MAX_LEN)
 
 struct addr_filter_buf{
-	bt_addr_le_t buf[DEFAULT_ADDR_FILTER_LEN];
-	int head;
+	bt_addr_le_t buf[CONFIG_APP_ALLOWLIST_MAX_LEN];
+	uint8_t group[CONFIG_APP_ALLOWLIST_MAX_LEN];
+	// entry index + 1 by hash slot, 0 for a free slot
+	uint16_t slot[ADDR_FILTER_SLOTS];
 	int size;
 };
 
@@ -44,26 +72,68 @@ struct remote_device_attr_info{
 	uint16_t read_chrc_value_handle;
 };
 
+struct auth_step{
+	const char *name;
+	uint32_t done_evt;
+	int (*start)(void);
+};
+
 static void start_scan();
 static void stop_scan();
+static void scan_watchdog_handler(struct k_work *work);
+static void allowlist_load_retry_handler(struct k_work *work);
 
-static int discover_attributes();
 static uint8_t attribute_discovered(struct bt_conn *conn, const struct bt_gatt_attr *attr, struct bt_gatt_discover_params *params);
 static uint8_t read_chrc_cb(struct bt_conn *conn, uint8_t err, struct bt_gatt_read_params *params, const void *data, uint16_t length);
 static void write_chrc_cb(struct bt_conn *conn, uint8_t err, struct bt_gatt_write_params *params);
 static uint8_t notify_cb(struct bt_conn *conn, struct bt_gatt_subscribe_params *params, const void *data, uint16_t length);
 static void subscribe_cb(struct bt_conn *conn, uint8_t err, struct bt_gatt_subscribe_params *params);
 
-K_MSGQ_DEFINE(ble_msgq, sizeof(struct ble_msg), 5, 4);
-K_EVENT_DEFINE(auth_evts);
+static void auth_timer_exp_cb(struct k_timer *timer);
+
+K_MSGQ_DEFINE(ble_msgq, sizeof(struct ble_msg), BLE_MSGQ_LEN, 4);
+K_TIMER_DEFINE(auth_timer, auth_timer_exp_cb, NULL);
+K_WORK_DELAYABLE_DEFINE(scan_watchdog, scan_watchdog_handler);
+K_WORK_DELAYABLE_DEFINE(allowlist_load_retry, allowlist_load_retry_handler);
 
 extern struct k_event main_evts;
 
 struct bt_conn *default_conn;
 bt_addr_le_t *last_scanned_address = NULL;
 struct addr_filter_buf addr_filter;
+// device_found() reads the filter in the BT RX thread while the BLE control
+// and uart stream threads change it
+static struct k_spinlock filter_lock;
 struct remote_device_attr_info attr_info = {0, 0, 0}; 
 bool authentication_enabled = false;
+int auth_door = 0;
+uint32_t auth_stage_start = 0;
+int auth_stage = BLE_AUTH_STAGE_NONE;
+int allowlist_load_idx = 0;
+atomic_t auth_evts = ATOMIC_INIT(0);
+atomic_t scanning = ATOMIC_INIT(0);
+atomic_t connecting = ATOMIC_INIT(0);
+// bit n set when an allowlisted tag may open door n, until main handles it
+atomic_t presence_doors = ATOMIC_INIT(0);
+// uptime an allowlisted tag was last seen, by filter index, 0 if never
+uint32_t tag_last_seen[CONFIG_APP_ALLOWLIST_MAX_LEN];
+
+static const struct bt_le_scan_param scan_idle_param = {
+	.type = BT_LE_SCAN_TYPE_PASSIVE,
+	.options = BT_LE_SCAN_OPT_NONE,
+	.interval = SCAN_IDLE_INTERVAL,
+	.window = SCAN_IDLE_WINDOW,
+};
+
+// follows the live connection interval, see set_connected_scan_param()
+static struct bt_le_scan_param scan_connected_param = {
+	.type = BT_LE_SCAN_TYPE_PASSIVE,
+	.options = BT_LE_SCAN_OPT_NONE,
+	.interval = SCAN_CONNECTED_INTERVAL(CONN_INTERVAL),
+	.window = SCAN_CONNECTED_WINDOW(CONN_INTERVAL),
+};
+
+static const struct bt_le_conn_param *conn_param = BT_LE_CONN_PARAM(CONN_INTERVAL, CONN_INTERVAL, 0, 400);
 
 static struct bt_gatt_discover_params d_params = {
 	.start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE,
@@ -86,15 +156,96 @@ static struct bt_gatt_subscribe_params sub_params = {
 };
 
 
-static int address_in_filter(const bt_addr_le_t *addr)
+// FNV-1a over type and address, public addresses share their first bytes
+static int filter_hash(const bt_addr_le_t *addr)
 {
-	for(int i=0; i<addr_filter.size; ++i){
-		if(bt_addr_le_cmp(addr, &addr_filter.buf[i]) == 0){
-			return i;
+	uint32_t h = 2166136261u ^ addr->type;
+
+	for(int i=0; i<sizeof(addr->a.val); ++i){
+		h = (h ^ addr->a.val[i]) * 16777619u;
+	}
+
+	return h % ADDR_FILTER_SLOTS;
+}
+
+// Slot holding addr, or the free slot ending its probe. Must be called with
+// filter_lock held
+static int filter_slot_locked(const bt_addr_le_t *addr)
+{
+	int s = filter_hash(addr);
+
+	// there are always free slots, so the probe ends
+	while(addr_filter.slot[s] && bt_addr_le_cmp(addr, &addr_filter.buf[addr_filter.slot[s] - 1])){
+		s = (s + 1) % ADDR_FILTER_SLOTS;
+	}
+
+	return s;
+}
+
+// Must be called with filter_lock held
+static int filter_find_locked(const bt_addr_le_t *addr)
+{
+	return addr_filter.slot[filter_slot_locked(addr)] - 1;
+}
+
+// Free slot s and move later entries of the probe back into the hole, so
+// lookups never stop early at it. Must be called with filter_lock held
+static void filter_unlink_slot_locked(int s)
+{
+	int next = s;
+
+	addr_filter.slot[s] = 0;
+	while(1){
+		next = (next + 1) % ADDR_FILTER_SLOTS;
+		if(!addr_filter.slot[next]){
+			return;
+		}
+
+		// an entry whose hash lies cyclically in (s, next] must stay after s
+		int home = filter_hash(&addr_filter.buf[addr_filter.slot[next] - 1]);
+		bool stays = (s < next) ? (s < home && home <= next) : (s < home || home <= next);
+		if(!stays){
+			addr_filter.slot[s] = addr_filter.slot[next];
+			addr_filter.slot[next] = 0;
+			s = next;
 		}
 	}
+}
+
+// Find addr in the filter, record it as seen now and return its group
+static int address_in_filter(const bt_addr_le_t *addr, uint8_t *group)
+{
+	k_spinlock_key_t key = k_spin_lock(&filter_lock);
+
+	int res = filter_find_locked(addr);
+	if(res >= 0){
+		*group = addr_filter.group[res];
+		// low bit set so a tag seen at uptime 0 does not read as never seen
+		tag_last_seen[res] = k_uptime_get_32() | 1;
+	}
+
+	k_spin_unlock(&filter_lock, key);
+	return res;
+}
+
+// Scanning pauses only while a connection is being initiated
+static int connect_tag(const bt_addr_le_t *addr)
+{
+	if(!atomic_cas(&connecting, 0, 1)){
+		return -EALREADY;
+	}
+
+	stop_scan();
+
+	auth_stage_start = k_uptime_get_32();
+	int res = bt_conn_le_create(addr, BT_CONN_LE_CREATE_CONN, conn_param, &default_conn);
+	if(res){
+		LOG_ERR("Create connection fail (err %d)", res);
+		atomic_clear(&connecting);
+		start_scan();
+	}
 
-	return -1;
+	return res;
 }
 
 // Scanned device found callback
@@ -102,49 +253,101 @@ static void device_found(const bt_addr_le_t *addr, int8_t rssi, uint8_t type,
 			 struct net_buf_simple *ad)
 {
     int res = 0;
-	char addr_str[BT_ADDR_LE_STR_LEN];
-	bt_addr_le_to_str(addr, addr_str, sizeof(addr_str));
+    uint8_t group = 0;
 
     // check if address is in authorised filter
-    res = address_in_filter(addr);
+    res = address_in_filter(addr, &group);
+    scan_stats_adv_received(addr, res >= 0);
     if(res < 0){
         return;
     }
 
+	char addr_str[BT_ADDR_LE_STR_LEN];
+	bt_addr_le_to_str(addr, addr_str, sizeof(addr_str));
 	LOG_DBG("Device found: %s", addr_str);
+	uart_stream_presence(addr, rssi);
 
 	last_scanned_address = &addr_filter.buf[res];
 
-	if(authentication_enabled){
-		stop_scan();
+	uint32_t doors = rules_allowed_doors(group);
+	if(doors == 0){
+		LOG_DBG("Access outside schedule: %s", addr_str);
+		return;
+	}
 
-		res = bt_conn_le_create(addr, BT_CONN_LE_CREATE_CONN, BT_LE_CONN_PARAM_DEFAULT, &default_conn);
-		if(res){
-			LOG_ERR("Create connection fail (err %d)", res);
-			start_scan();
-		}
+	// tags seen while another one is connected wait in tag_last_seen
+	if(authentication_enabled && default_conn == NULL && (doors & BIT(auth_door)) &&
+		connect_tag(addr) == 0){
 		return;
 	}
 
+	atomic_or(&presence_doors, (atomic_val_t)doors);
 	k_event_set(&main_evts, MAIN_EVT_BLE_DEVICE_FOUND);
 }
 
+// Connect to the most recently seen tag, if it is still around
+static void connect_waiting_tag()
+{
+	uint32_t now = k_uptime_get_32();
+	int best = -1;
+	bt_addr_le_t addr;
+
+	k_spinlock_key_t key = k_spin_lock(&filter_lock);
+	for(int i=0; i<addr_filter.size; ++i){
+		if(tag_last_seen[i] == 0 || now - tag_last_seen[i] > WAITING_TAG_TIMEOUT_MS){
+			continue;
+		}
+		if(!(rules_allowed_doors(addr_filter.group[i]) & BIT(auth_door))){
+			continue;
+		}
+		if(best < 0 || (int32_t)(tag_last_seen[i] - tag_last_seen[best]) > 0){
+			best = i;
+		}
+	}
+	if(best >= 0){
+		bt_addr_le_copy(&addr, &addr_filter.buf[best]);
+	}
+	k_spin_unlock(&filter_lock, key);
+
+	if(best >= 0 && default_conn == NULL){
+		LOG_DBG("Connect waiting tag %d", best);
+		connect_tag(&addr);
+	}
+}
+
+static void set_connected_scan_param(uint16_t conn_interval)
+{
+	scan_connected_param.interval = SCAN_CONNECTED_INTERVAL(conn_interval);
+	scan_connected_param.window = SCAN_CONNECTED_WINDOW(conn_interval);
+	LOG_DBG("Connected scan window %d every %d (0.625 ms units)",
+		scan_connected_param.window, scan_connected_param.interval);
+}
+
 static void start_scan(void)
 {
 	int err;
-	err = bt_le_scan_start(BT_LE_SCAN_PASSIVE, device_found);
+	const struct bt_le_scan_param *param = default_conn ? &scan_connected_param : &scan_idle_param;
+
+	if(atomic_get(&scanning)){
+		stop_scan();
+	}
+
+	err = bt_le_scan_start(param, device_found);
 	if (err) {
 		LOG_ERR("Scanning failed to start (err %d)\n", err);
 		return;
 	}
 
-	LOG_INF("Scanning started");
+	atomic_set(&scanning, 1);
+	LOG_INF("Scanning started (%s)", default_conn ? "connected" : "idle");
+	startup_milestone(STARTUP_SCAN_STARTED);
 }
 
 static void stop_scan()
 {
 	int err = 0;
 	err = bt_le_scan_stop();
+	atomic_clear(&scanning);
 	if(err){
 		LOG_ERR("Scan stop fail (err %d)", err);
 		return;
@@ -153,23 +356,60 @@ static void stop_scan()
 	LOG_DBG("Scanning stopped");
 }
 
+// Scanning must resume after any failed or aborted connection
+static void scan_watchdog_handler(struct k_work *work)
+{
+	if(!atomic_get(&scanning) && !atomic_get(&connecting)){
+		LOG_WRN("Scan watchdog restarting scan");
+		start_scan();
+	}
+
+	k_work_schedule(&scan_watchdog, K_MSEC(SCAN_WATCHDOG_PERIOD_MS));
+}
+
+// Record a GATT procedure result and let the BLE control handler advance
+static void set_auth_evt(uint32_t evt)
+{
+	struct ble_msg msg = {
+		.type = BLE_MSG_TYPE_AUTH_PROGRESS
+	};
+
+	atomic_or(&auth_evts, evt);
+	// if the queue is full, the stage timeout picks the event up
+	ble_post(&msg);
+}
+
 static void connected(struct bt_conn *conn, uint8_t err)
 {
+	uart_stream_auth_stage(BLE_AUTH_STAGE_CONNECT, k_uptime_get_32() - auth_stage_start, err);
+	atomic_clear(&connecting);
 	if(err){
 		LOG_ERR("BLE connect fail (err %d)", err);
+		// no disconnected callback follows a failed connection
+		bt_conn_unref(default_conn);
+		default_conn = NULL;
+		start_scan();
 		return;
 	}
 
 	LOG_INF("Remote device connected");
+	struct bt_conn_info info;
+	if(bt_conn_get_info(conn, &info) == 0){
+		set_connected_scan_param(info.le.interval);
+	}
+	start_scan();
 
 	k_event_set(&main_evts, MAIN_EVT_BLE_DEVICE_CONNECTED);
 
+	auth_stage_start = k_uptime_get_32();
+	atomic_clear(&auth_evts);
 	d_params.type = BT_GATT_DISCOVER_PRIMARY;
 	d_params.uuid = MAIN_SERVICE_UUID;
+	d_params.start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE;
 	int res = bt_gatt_discover(conn, &d_params);
 	if(res){
 		LOG_ERR("Discover primary service fail(err %d)", res);
-		k_event_set(&auth_evts, AUTH_EVT_ATTR_DISCOVER_FAIL);
+		set_auth_evt(AUTH_EVT_ATTR_DISCOVER_FAIL);
 	}
 }
 
@@ -178,6 +418,7 @@ static void disconnected(struct bt_conn *conn, uint8_t reason)
 	LOG_INF("BLE disconnected (reason %d)", reason);
 	bt_conn_unref(conn);
 	default_conn = NULL;
+	// back to idle scan parameters
 	start_scan();
 }
 
@@ -185,27 +426,27 @@ static uint8_t attribute_discovered(struct bt_conn *conn, const struct bt_gatt_a
 {
 	if(params->type == BT_GATT_DISCOVER_PRIMARY){
 		LOG_DBG("Primary service discovered");
-		k_event_set(&auth_evts, AUTH_EVT_PRIMARY_DISCOVERED);
+		set_auth_evt(AUTH_EVT_PRIMARY_DISCOVERED);
 	}
 	else if(params->type == BT_GATT_DISCOVER_CHARACTERISTIC){
 		if(bt_uuid_cmp(params->uuid, WRITE_CHRC) == 0){
 			LOG_DBG("Write chrc discovered");
 			struct bt_gatt_chrc *w_chrc = (struct bt_gatt_chrc *)attr->user_data;
 			attr_info.write_chrc_value_handle = w_chrc->value_handle;
-			k_event_set(&auth_evts, AUTH_EVT_WRITE_CHRC_DISCOVERED);
+			set_auth_evt(AUTH_EVT_WRITE_CHRC_DISCOVERED);
 		}
 		else if(bt_uuid_cmp(params->uuid, READ_CHRC) == 0){
 			LOG_DBG("read chrc discovered");
 			struct bt_gatt_chrc *r_chrc = (struct bt_gatt_chrc *)attr->user_data;
 			attr_info.read_chrc_value_handle = r_chrc->value_handle;
 			attr_info.read_chrc_attr_handle = bt_gatt_attr_get_handle(attr);
-			k_event_set(&auth_evts, AUTH_EVT_READ_DISCOVERED);
+			set_auth_evt(AUTH_EVT_READ_DISCOVERED);
 		}
 	}
 	else if(params->type == BT_GATT_DISCOVER_DESCRIPTOR){
 		if(bt_uuid_cmp(params->uuid, BT_UUID_GATT_CCC) == 0){
 			attr_info.read_ccc_handle = bt_gatt_attr_get_handle(attr);
-			k_event_set(&auth_evts, AUTH_EVT_READ_CCC_DISCOVERED);
+			set_auth_evt(AUTH_EVT_READ_CCC_DISCOVERED);
 		}
 	}
 
@@ -242,173 +483,393 @@ static void subscribe_cb(struct bt_conn *conn, uint8_t err, struct bt_gatt_subsc
 
 	if(params->value == BT_GATT_CCC_NOTIFY){
 		LOG_DBG("Notifications enabled");
-		k_event_set(&auth_evts, AUTH_EVT_NOTIFICATIONS_ENABLED);
+		set_auth_evt(AUTH_EVT_NOTIFICATIONS_ENABLED);
 	}
 }
 
 
-static int discover_attributes()
+static int discover_write_chrc()
 {
-	int ret = 0;
-	uint32_t evts = 0;
-	evts = k_event_wait(&auth_evts, AUTH_EVT_PRIMARY_DISCOVERED, false, K_MSEC(5000));
-	if(!evts){
-		LOG_ERR("Discover primary timeout");
-		return -ETIMEDOUT;
-	}
-
 	d_params.type = BT_GATT_DISCOVER_CHARACTERISTIC;
 	d_params.uuid = WRITE_CHRC;
-	ret = bt_gatt_discover(default_conn, &d_params);
-	if(ret){
-		LOG_ERR("Discover write fail(err %d)", ret);
-		return ret;
-	}
-
-	evts = k_event_wait(&auth_evts, AUTH_EVT_WRITE_CHRC_DISCOVERED, true, K_MSEC(5000));
-	if(!evts){
-		LOG_ERR("Discover write chrc timeout");
-		return -ETIMEDOUT;
-	}
+	return bt_gatt_discover(default_conn, &d_params);
+}
 
+static int discover_read_chrc()
+{
 	d_params.type = BT_GATT_DISCOVER_CHARACTERISTIC;
 	d_params.uuid = READ_CHRC;
-	ret = bt_gatt_discover(default_conn, &d_params);
-	if(ret){
-		LOG_ERR("Discover read fail(err %d)", ret);
-		return ret;
-	}
-
-	evts = k_event_wait(&auth_evts, AUTH_EVT_READ_DISCOVERED, true, K_MSEC(5000));
-	if(!evts){
-		LOG_ERR("Discover read chrc timeout");
-		return -ETIMEDOUT;
-	}
+	return bt_gatt_discover(default_conn, &d_params);
+}
 
+static int discover_read_ccc()
+{
 	d_params.type = BT_GATT_DISCOVER_DESCRIPTOR;
 	d_params.uuid = BT_UUID_GATT_CCC;
 	d_params.start_handle = attr_info.read_chrc_attr_handle;
-	ret = bt_gatt_discover(default_conn, &d_params);
-	if(ret){
-		LOG_ERR("Discover read CCC fail(err %d)", ret);
-		return ret;
-	}
-
-	evts = k_event_wait(&auth_evts, AUTH_EVT_READ_CCC_DISCOVERED, true, K_MSEC(5000));
-	if(!evts){
-		LOG_ERR("Discover read CCC timeout");
-		return -ETIMEDOUT;
-	}
+	return bt_gatt_discover(default_conn, &d_params);
+}
 
+static int enable_notifications()
+{
 	sub_params.ccc_handle = attr_info.read_ccc_handle;
 	sub_params.value_handle = attr_info.read_chrc_value_handle;
 	sub_params.value = BT_GATT_CHRC_NOTIFY;
-	ret = bt_gatt_subscribe(default_conn, &sub_params);
-	if(ret){
-		LOG_ERR("Enable notifications fail (err %d)", ret);
-		return ret;
+	return bt_gatt_subscribe(default_conn, &sub_params);
+}
+
+// Authentication steps, each completes when its GATT callback sets done_evt.
+// Primary discovery is started from the connected callback.
+static const struct auth_step auth_steps[] = {
+	[BLE_AUTH_STAGE_PRIMARY_DISCOVERY] = {"Discover primary", AUTH_EVT_PRIMARY_DISCOVERED, NULL},
+	[BLE_AUTH_STAGE_WRITE_CHRC_DISCOVERY] = {"Discover write chrc", AUTH_EVT_WRITE_CHRC_DISCOVERED, discover_write_chrc},
+	[BLE_AUTH_STAGE_READ_CHRC_DISCOVERY] = {"Discover read chrc", AUTH_EVT_READ_DISCOVERED, discover_read_chrc},
+	[BLE_AUTH_STAGE_READ_CCC_DISCOVERY] = {"Discover read CCC", AUTH_EVT_READ_CCC_DISCOVERED, discover_read_ccc},
+	[BLE_AUTH_STAGE_ENABLE_NOTIFICATIONS] = {"Enable notifications", AUTH_EVT_NOTIFICATIONS_ENABLED, enable_notifications},
+};
+
+static void auth_timer_exp_cb(struct k_timer *timer)
+{
+	struct ble_msg msg = {
+		.type = BLE_MSG_TYPE_AUTH_TIMEOUT
+	};
+
+	if(ble_post(&msg)){
+		k_timer_start(timer, K_MSEC(AUTH_TIMEOUT_RETRY_MS), K_NO_WAIT);
 	}
+}
 
-	evts = k_event_wait(&auth_evts, AUTH_EVT_NOTIFICATIONS_ENABLED, true, K_MSEC(5000));
-	if(!evts){
-		LOG_ERR("Enable notifications timeout");
-		return -ETIMEDOUT;
+static void finish_authentication(int err)
+{
+	k_timer_stop(&auth_timer);
+	uart_stream_auth_stage(auth_stage, k_uptime_get_32() - auth_stage_start, err);
+	auth_stage = BLE_AUTH_STAGE_NONE;
+
+	// TODO data exchange
+	k_event_set(&main_evts, err ? MAIN_EVT_BLE_DEVICE_AUTHENTICATION_FAIL : MAIN_EVT_BLE_DEVICE_AUTHENTICATED);
+}
+
+static void start_auth_stage(int stage)
+{
+	auth_stage = stage;
+	auth_stage_start = k_uptime_get_32();
+	atomic_and(&auth_evts, ~auth_steps[stage].done_evt);
+
+	int res = auth_steps[stage].start();
+	if(res){
+		LOG_ERR("%s fail(err %d)", auth_steps[stage].name, res);
+		finish_authentication(res);
+		return;
 	}
 
-	return 0;
+	k_timer_start(&auth_timer, K_MSEC(AUTH_STAGE_TIMEOUT_MS), K_NO_WAIT);
+}
+
+static void advance_authentication()
+{
+	if(auth_stage == BLE_AUTH_STAGE_NONE){
+		return;
+	}
+
+	atomic_val_t evts = atomic_get(&auth_evts);
+	if(evts & AUTH_EVT_ATTR_DISCOVER_FAIL){
+		finish_authentication(-EIO);
+		return;
+	}
+
+	if(!(evts & auth_steps[auth_stage].done_evt)){
+		return;
+	}
+
+	if(auth_stage == ARRAY_SIZE(auth_steps) - 1){
+		finish_authentication(0);
+		return;
+	}
+
+	uart_stream_auth_stage(auth_stage, k_uptime_get_32() - auth_stage_start, 0);
+	start_auth_stage(auth_stage + 1);
 }
 
 static void authenticate_remote_device()
 {
-	if(discover_attributes()){
-		k_event_set(&main_evts, MAIN_EVT_BLE_DEVICE_AUTHENTICATION_FAIL);
+	// primary discovery was started on connect, time it from there
+	auth_stage = BLE_AUTH_STAGE_PRIMARY_DISCOVERY;
+	k_timer_start(&auth_timer, K_MSEC(AUTH_STAGE_TIMEOUT_MS), K_NO_WAIT);
+	advance_authentication();
+}
+
+static void authentication_timeout()
+{
+	// a timeout queued before the stage advanced finds the timer restarted
+	if(auth_stage == BLE_AUTH_STAGE_NONE || k_timer_remaining_get(&auth_timer) > 0){
 		return;
 	}
 
-	// TODO data exchange
-	k_event_set(&main_evts, MAIN_EVT_BLE_DEVICE_AUTHENTICATED);
+	// the stage finished but its progress message was dropped
+	if(atomic_get(&auth_evts) & (auth_steps[auth_stage].done_evt | AUTH_EVT_ATTR_DISCOVER_FAIL)){
+		LOG_WRN("%s progress message lost", auth_steps[auth_stage].name);
+		advance_authentication();
+		return;
+	}
+
+	LOG_ERR("%s timeout", auth_steps[auth_stage].name);
+	finish_authentication(-ETIMEDOUT);
+}
+
+// The tag may request another interval, keep the scan windows in step with it
+static void le_param_updated(struct bt_conn *conn, uint16_t interval, uint16_t latency, uint16_t timeout)
+{
+	if(conn != default_conn){
+		return;
+	}
+
+	LOG_INF("Connection interval now %d (1.25 ms units)", interval);
+	set_connected_scan_param(interval);
+	if(atomic_get(&scanning)){
+		start_scan();
+	}
 }
 
 BT_CONN_CB_DEFINE(conn_callbacks) = {
 	.connected = connected,
 	.disconnected = disconnected,
+	.le_param_updated = le_param_updated,
 };
 
-static int init_addr_filter()
+// Queue the next allowlist chunk, retrying until the BLE control queue has room
+static void request_allowlist_load()
 {
-	// TODO read from storage
-	memset(&addr_filter, 0, sizeof(addr_filter));
-	ble_add_addr_to_filter(&test_address1);
+	struct ble_msg msg = {
+		.type = BLE_MSG_TYPE_LOAD_ALLOWLIST
+	};
 
-	return 0;
+	if(ble_post(&msg)){
+		LOG_WRN("BLE queue full, allowlist load retry at entry %d", allowlist_load_idx);
+		k_work_schedule(&allowlist_load_retry, K_MSEC(ALLOWLIST_LOAD_RETRY_MS));
+	}
 }
 
-void ble_thread_main(void)
+static void allowlist_load_retry_handler(struct k_work *work)
 {
-	LOG_DBG("Start ble thread");
-	int res = 0;
+	request_allowlist_load();
+}
 
-	res = init_addr_filter();
-	if(res){
+static void load_allowlist_chunk()
+{
+	bt_addr_le_t addr;
+	uint8_t group;
+
+	for(int i=0; i<ALLOWLIST_LOAD_CHUNK; ++i){
+		if(storage_read_allowlist_entry(allowlist_load_idx, &addr, &group)){
+			LOG_INF("Allowlist loaded (%d entries)", allowlist_load_idx);
+			startup_milestone(STARTUP_ALLOWLIST_LOADED);
+			return;
+		}
+
+		// a full filter is logged, keep loading so the index moves on
+		ble_add_addr_to_filter(&addr, group);
+		allowlist_load_idx++;
+		startup_milestone(STARTUP_ALLOWLIST_FIRST_ENTRY);
+	}
+
+	// continue after whatever else is queued, scanning is already running
+	request_allowlist_load();
+}
+
+static void bt_ready(int err)
+{
+	if(err){
+		LOG_ERR("BLE enable fail (err %d)", err);
 		return;
 	}
 
+	startup_milestone(STARTUP_BT_READY);
+
+	// Scan with whatever is in the filter, the stored allowlist streams in after
+	LOG_DBG("Start scan");
+	start_scan();
+	k_work_schedule(&scan_watchdog, K_MSEC(SCAN_WATCHDOG_PERIOD_MS));
+
+	request_allowlist_load();
+}
+
+static int ble_init(const struct device *dev)
+{
+	ARG_UNUSED(dev);
+
 	LOG_DBG("Enable BLE");
-	res = bt_enable(NULL);
+	int res = bt_enable(bt_ready);
 	if(res){
 		LOG_ERR("BLE enable fail (err %d)", res);
-		return;
+		return res;
 	}
 
+	return 0;
+}
 
-	// TODO  wait for main to populate filter buffer before starting scan
-	LOG_DBG("Start scan");
-	start_scan();
+// Bring the controller up before any application thread starts
+SYS_INIT(ble_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+
+static void ble_handle_msg(const struct ble_msg *msg)
+{
+	if(msg->type == BLE_MSG_TYPE_ENABLE_AUTHENTICATION){
+		LOG_INF("Enable authentication (door %d)", msg->door);
+		auth_door = msg->door;
+		authentication_enabled = true;
+		connect_waiting_tag();
+	}
+	else if(msg->type == BLE_MSG_TYPE_START_AUTHENTICATION){
+		LOG_INF("Authenticate remote device");
+		authenticate_remote_device();
+	}
+	else if(msg->type == BLE_MSG_TYPE_STOP_AUTHENTICATION){
+		LOG_INF("Stop athentication");
+		k_timer_stop(&auth_timer);
+		auth_stage = BLE_AUTH_STAGE_NONE;
+		if(default_conn != NULL){
+			int res = bt_conn_disconnect(default_conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+			if(res){
+				LOG_ERR("BLE disconnect device error %d", res);
+			}
+		}
+		authentication_enabled = false;
+	}
+	else if(msg->type == BLE_MSG_TYPE_AUTH_PROGRESS){
+		advance_authentication();
+	}
+	else if(msg->type == BLE_MSG_TYPE_AUTH_TIMEOUT){
+		authentication_timeout();
+	}
+	else if(msg->type == BLE_MSG_TYPE_LOAD_ALLOWLIST){
+		load_allowlist_chunk();
+	}
+}
+
+#if defined(CONFIG_APP_WORKQUEUE)
+
+static void ble_work_handler(struct k_work *work)
+{
+	struct ble_msg msg;
+	while(k_msgq_get(&ble_msgq, &msg, K_NO_WAIT) == 0){
+		ble_handle_msg(&msg);
+	}
+}
+
+K_WORK_DEFINE(ble_work, ble_work_handler);
+
+#else
+
+void ble_thread_main(void)
+{
+	LOG_DBG("Start ble thread");
 
 	struct ble_msg msg;
 	while(1){
 		k_msgq_get(&ble_msgq, &msg, K_FOREVER);
-		if(msg.type == BLE_MSG_TYPE_ENABLE_AUTHENTICATION){
-			LOG_INF("Enable authentication");
-			authentication_enabled = true;
-		}
-		else if(msg.type == BLE_MSG_TYPE_START_AUTHENTICATION){
-			LOG_INF("Authenticate remote device");
-			authenticate_remote_device();
-		}
-		else if(msg.type == BLE_MSG_TYPE_STOP_AUTHENTICATION){
-			LOG_INF("Stop athentication");
-			if(default_conn != NULL){
-				int res = bt_conn_disconnect(default_conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
-				if(res){
-					LOG_ERR("BLE disconnect device error %d", res);
-				}
-			}
-			authentication_enabled = false;
-		}
+		ble_handle_msg(&msg);
+	}
+}
+
+// create and start BLE thread
+K_THREAD_DEFINE(ble_thread, CONFIG_APP_BLE_THREAD_STACK_SIZE, ble_thread_main, NULL, NULL, NULL, 1, K_ESSENTIAL, 0);
+
+#endif
+
+int ble_post(const struct ble_msg *msg)
+{
+	int res = k_msgq_put(&ble_msgq, msg, K_NO_WAIT);
+
+#if defined(CONFIG_APP_WORKQUEUE)
+	if(!res){
+		k_work_submit_to_queue(&app_workq, &ble_work);
 	}
+#endif
+
+	return res;
+}
+
+int ble_filter_lookup(const bt_addr_le_t *addr, uint8_t *group)
+{
+	return address_in_filter(addr, group);
 }
 
-int ble_add_addr_to_filter(bt_addr_le_t *addr)
+uint32_t ble_take_presence_doors()
 {
-	if(addr_filter.head >= DEFAULT_ADDR_FILTER_LEN){
-		addr_filter.head = 0;
+	return (uint32_t)atomic_clear(&presence_doors);
+}
+
+int ble_add_addr_to_filter(const bt_addr_le_t *addr, uint8_t group)
+{
+	int res = 0;
+	char addr_str[BT_ADDR_LE_STR_LEN];
+	bt_addr_le_to_str(addr, addr_str, sizeof(addr_str));
+
+	k_spinlock_key_t key = k_spin_lock(&filter_lock);
+
+	int s = filter_slot_locked(addr);
+	if(addr_filter.slot[s]){
+		// already allowlisted, only the group changes
+		addr_filter.group[addr_filter.slot[s] - 1] = group;
+	}
+	else if(addr_filter.size < CONFIG_APP_ALLOWLIST_MAX_LEN){
+		int idx = addr_filter.size;
+		bt_addr_le_copy(&addr_filter.buf[idx], addr);
+		addr_filter.group[idx] = group;
+		tag_last_seen[idx] = 0;
+		addr_filter.slot[s] = idx + 1;
+		addr_filter.size++;
+	}
+	else{
+		res = -ENOMEM;
 	}
 
-	bt_addr_le_copy(&addr_filter.buf[addr_filter.head], addr);
-	addr_filter.head++;
-	addr_filter.size++;
+	k_spin_unlock(&filter_lock, key);
 
-	if(addr_filter.size >= DEFAULT_ADDR_FILTER_LEN){
-		addr_filter.size = DEFAULT_ADDR_FILTER_LEN;
+	if(res){
+		LOG_WRN("Address filter full, %s not added", addr_str);
 	}
+	else{
+		LOG_DBG("Add address to filter %s (group %d)", addr_str, group);
+	}
+
+	return res;
+}
+
+int ble_remove_addr_from_filter(const bt_addr_le_t *addr)
+{
+	k_spinlock_key_t key = k_spin_lock(&filter_lock);
+
+	int s = filter_slot_locked(addr);
+	int idx = addr_filter.slot[s] - 1;
+	if(idx >= 0){
+		filter_unlink_slot_locked(s);
+
+		// move the last entry into the hole and point its slot there
+		int last = addr_filter.size - 1;
+		if(idx != last){
+			addr_filter.slot[filter_slot_locked(&addr_filter.buf[last])] = idx + 1;
+			bt_addr_le_copy(&addr_filter.buf[idx], &addr_filter.buf[last]);
+			addr_filter.group[idx] = addr_filter.group[last];
+			tag_last_seen[idx] = tag_last_seen[last];
+		}
+		addr_filter.size--;
+	}
+
+	k_spin_unlock(&filter_lock, key);
 
 	char addr_str[BT_ADDR_LE_STR_LEN];
 	bt_addr_le_to_str(addr, addr_str, sizeof(addr_str));
-	LOG_DBG("Add address to filter %s", addr_str);
+	LOG_DBG("Remove address from filter %s (%s)", addr_str, idx >= 0 ? "removed" : "not found");
 
-	return 0;
+	return idx >= 0 ? 0 : -ENOENT;
 }
 
-// create and start BLE thread
-K_THREAD_DEFINE(ble_thread, 1024, ble_thread_main, NULL, NULL, NULL, 1, K_ESSENTIAL, 0);
+void ble_clear_filter()
+{
+	k_spinlock_key_t key = k_spin_lock(&filter_lock);
+	memset(addr_filter.slot, 0, sizeof(addr_filter.slot));
+	addr_filter.size = 0;
+	k_spin_unlock(&filter_lock, key);
+
+	LOG_INF("Address filter cleared");
+}
@@ -9,24 +9,79 @@ enum ble_message_types{
     BLE_MSG_TYPE_START_AUTHENTICATION,
     BLE_MSG_TYPE_STOP_AUTHENTICATION,
     BLE_MSG_STOP_SCAN,
+    BLE_MSG_TYPE_AUTH_PROGRESS,
+    BLE_MSG_TYPE_AUTH_TIMEOUT,
+    BLE_MSG_TYPE_LOAD_ALLOWLIST,
+};
+
+enum ble_auth_stages{
+    BLE_AUTH_STAGE_NONE = -1,
+    BLE_AUTH_STAGE_CONNECT,
+    BLE_AUTH_STAGE_PRIMARY_DISCOVERY,
+    BLE_AUTH_STAGE_WRITE_CHRC_DISCOVERY,
+    BLE_AUTH_STAGE_READ_CHRC_DISCOVERY,
+    BLE_AUTH_STAGE_READ_CCC_DISCOVERY,
+    BLE_AUTH_STAGE_ENABLE_NOTIFICATIONS,
 };
 
 struct ble_msg{
     int type;
+    int door;           // BLE_MSG_TYPE_ENABLE_AUTHENTICATION only
 };
 
 /**
- * @brief BLE thread entry function
+ * @brief Queue a message for BLE control
+ * 
+ * Safe to call from BT callbacks and ISRs.
  * 
+ * @param msg message to queue
+ * @return 0 on success, -ENOMSG if the BLE queue is full
  */
-void ble_thread_main();
+int ble_post(const struct ble_msg *msg);
+
+/**
+ * @brief Get and clear the doors a found tag may open
+ * 
+ * @return bitmask, bit n set for door n
+ */
+uint32_t ble_take_presence_doors();
+
+/**
+ * @brief Look up an address in the address filter
+ * 
+ * The lookup done for every scanned advert, including recording the
+ * address as seen. Exposed for the lookup benchmark.
+ * 
+ * @param addr address to look up
+ * @param group set to the access rule group of the address if found
+ * @return filter index, negative if the address is not in the filter
+ */
+int ble_filter_lookup(const bt_addr_le_t *addr, uint8_t *group);
 
 /**
  * @brief Add address to address filter
  * 
+ * Safe to call from any thread. Adding an address already in the filter
+ * only changes its group.
+ * 
  * @param addr address to add
- * @return 0 on success
+ * @param group access rule group of the address
+ * @return 0 on success, -ENOMEM if the filter is full
+ */
+int ble_add_addr_to_filter(const bt_addr_le_t *addr, uint8_t group);
+
+/**
+ * @brief Remove address from address filter
+ * 
+ * @param addr address to remove
+ * @return 0 on success, -ENOENT if the address is not in the filter
+ */
+int ble_remove_addr_from_filter(const bt_addr_le_t *addr);
+
+/**
+ * @brief Remove all addresses from address filter
+ * 
  */
-int ble_add_addr_to_filter(bt_addr_le_t *addr);
+void ble_clear_filter();
 
 #endif
\ No newline at end of file
@@ -1,55 +1,110 @@
 #include "input.h"
 
 #include <zephyr/drivers/gpio.h>
+#include <zephyr/init.h>
 #include <zephyr/logging/log.h>
 
 LOG_MODULE_REGISTER(INPUT);
 
-#define INPUT_BTN_NODE DT_NODELABEL(button_input)
+#define BUTTONS_NODE DT_PATH(door_buttons)
+
+struct input_button{
+    struct gpio_dt_spec gpio_spec;
+    struct gpio_callback callback;
+    uint8_t door;
+};
+
+#define INPUT_BUTTON_ENTRY(node)                                            \
+    {                                                                       \
+        .gpio_spec = GPIO_DT_SPEC_GET(node, gpios),                         \
+        .door = DT_PROP(node, door),                                        \
+    },
+
+#define INPUT_BUTTON_CHECK_DOOR(node)                                       \
+    BUILD_ASSERT(DT_PROP(node, door) < OUTPUT_DOOR_COUNT,                   \
+        "Button door index out of range");
+
+DT_FOREACH_CHILD(BUTTONS_NODE, INPUT_BUTTON_CHECK_DOOR)
+BUILD_ASSERT(OUTPUT_DOOR_COUNT <= 32, "Pressed doors are tracked in one atomic_t");
 
 extern struct k_event main_evts;
 
-struct gpio_dt_spec input_btn_spec = GPIO_DT_SPEC_GET(INPUT_BTN_NODE, gpios); 
-struct gpio_callback input_btn_callback;
+struct input_button input_buttons[] = {
+    DT_FOREACH_CHILD(BUTTONS_NODE, INPUT_BUTTON_ENTRY)
+};
+
+// bit n set when the button of door n was pressed and not yet handled
+atomic_t pressed_doors = ATOMIC_INIT(0);
 
 static void input_btn_pressed_callback(const struct device *dev, struct gpio_callback *cb, gpio_port_pins_t pins)
 {
+    struct input_button *btn = CONTAINER_OF(cb, struct input_button, callback);
+
+    atomic_set_bit(&pressed_doors, btn->door);
     k_event_set(&main_evts, MAIN_EVT_BTN_PRESSED);
 }
 
-int input_init()
+static int init_button(struct input_button *btn)
 {
     int ret = 0;
-    if(!device_is_ready(input_btn_spec.port)){
+    if(!device_is_ready(btn->gpio_spec.port)){
         LOG_ERR("Button input not ready");
         return -ENODEV;
     }
 
-    gpio_init_callback(&input_btn_callback, input_btn_pressed_callback, BIT(input_btn_spec.pin));
-    ret = gpio_pin_interrupt_configure_dt(&input_btn_spec, GPIO_INT_EDGE_TO_ACTIVE);
+    gpio_init_callback(&btn->callback, input_btn_pressed_callback, BIT(btn->gpio_spec.pin));
+    ret = gpio_pin_interrupt_configure_dt(&btn->gpio_spec, GPIO_INT_EDGE_TO_ACTIVE);
     if(ret){
         LOG_ERR("Input btn interrupt config fail (err %d)", ret);
         return ret;
     }
 
-    ret = gpio_add_callback(input_btn_spec.port, &input_btn_callback);
+    ret = gpio_add_callback(btn->gpio_spec.port, &btn->callback);
     if(ret){
         LOG_ERR("Input btn add interrupt callback fail (err %d)", ret);
         return ret;
     }
 
-    ret = gpio_pin_configure_dt(&input_btn_spec, GPIO_INPUT);
+    ret = gpio_pin_configure_dt(&btn->gpio_spec, GPIO_INPUT);
     if(ret){
         LOG_ERR("Input btn config fail (err %d)", ret);
         return ret;
     }
 
-    ret = gpio_pin_set_dt(&input_btn_spec, 1);
+    ret = gpio_pin_set_dt(&btn->gpio_spec, 1);
     if(ret){
         LOG_ERR("input button init fail (err %d)", ret);
         return ret;
     }
 
+    return 0;
+}
+
+static int input_init(const struct device *dev)
+{
+    ARG_UNUSED(dev);
+
+    for(int i=0; i<ARRAY_SIZE(input_buttons); ++i){
+        int ret = init_button(&input_buttons[i]);
+        if(ret){
+            return ret;
+        }
+    }
+
     LOG_INF("Inputs initialised");
+    startup_milestone(STARTUP_INPUTS_READY);
     return 0;
-}
\ No newline at end of file
+}
+
+// Buttons are live before any application thread starts
+SYS_INIT(input_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+
+bool input_door_pressed()
+{
+    return atomic_get(&pressed_doors) != 0;
+}
+
+uint32_t input_take_pressed_doors()
+{
+    return (uint32_t)atomic_clear(&pressed_doors);
+}
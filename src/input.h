@@ -3,6 +3,18 @@
 
 #include "main.h"
 
-int input_init();
+/**
+ * @brief Check for button presses not yet taken
+ * 
+ * @return true if any door button was pressed
+ */
+bool input_door_pressed();
 
-#endif
\ No newline at end of file
+/**
+ * @brief Get and clear the doors whose button was pressed
+ * 
+ * @return bitmask, bit n set for door n
+ */
+uint32_t input_take_pressed_doors();
+
+#endif
@@ -7,88 +7,104 @@ LOG_MODULE_REGISTER(MAIN);
 
 K_EVENT_DEFINE(main_evts);
 
-extern struct k_msgq ble_msgq;
-extern struct k_msgq output_msgq;
-
-static void update_authentication_state(int state)
+static void update_authentication_state(int state, int door)
 {
 	struct ble_msg msg = {
-		.type = state
+		.type = state,
+		.door = door
 	};
 
-	k_msgq_put(&ble_msgq, &msg, K_NO_WAIT);
+	ble_post(&msg);
 }
 
-static void toggle_output(int type, int state)
+static void toggle_output(int door, int type, int state)
 {
 	struct output_msg out_msg = {
 		.type = type,
-		.state = state
+		.state = state,
+		.door = door
 	};
 
-	k_msgq_put(&output_msgq, &out_msg, K_NO_WAIT);
+	output_post(&out_msg);
 }
 
-static void wait_authentication()
+static void wait_authentication(int door)
 {
 	uint32_t evts = 0;
 
 	evts = k_event_wait(&main_evts, MAIN_EVT_BLE_DEVICE_CONNECTED, true, K_SECONDS(10));
 	if(!evts){
 		LOG_ERR("Connect device timeout");
-		toggle_output(OUTPUT_MSG_TYPE_TOGGLE_LED, LED_STATE_OFF);
-		toggle_output(OUTPUT_MSG_TYPE_TOGGLE_OVERHEAD_LIGHT, LIGHT_STATE_OFF);
-		toggle_output(OUTPUT_MSG_TOGGLE_TAG_AUTHENTICATION_FAIL, LIGHT_STATE_ON);
+		toggle_output(door, OUTPUT_MSG_TYPE_TOGGLE_LED, LED_STATE_OFF);
+		toggle_output(door, OUTPUT_MSG_TYPE_TOGGLE_OVERHEAD_LIGHT, LIGHT_STATE_OFF);
+		toggle_output(door, OUTPUT_MSG_TOGGLE_TAG_AUTHENTICATION_FAIL, LIGHT_STATE_ON);
 
-		update_authentication_state(BLE_MSG_TYPE_STOP_AUTHENTICATION);
+		update_authentication_state(BLE_MSG_TYPE_STOP_AUTHENTICATION, door);
 		return;
 	}
 
-	update_authentication_state(BLE_MSG_TYPE_START_AUTHENTICATION);
+	update_authentication_state(BLE_MSG_TYPE_START_AUTHENTICATION, door);
 	evts = k_event_wait(&main_evts, MAIN_EVT_BLE_DEVICE_AUTHENTICATED | MAIN_EVT_BLE_DEVICE_AUTHENTICATION_FAIL, true, K_SECONDS(15));
 	if(!evts){
 		LOG_ERR("Authentication timeout");
-		toggle_output(OUTPUT_MSG_TOGGLE_TAG_AUTHENTICATION_FAIL, LIGHT_STATE_ON);
+		toggle_output(door, OUTPUT_MSG_TOGGLE_TAG_AUTHENTICATION_FAIL, LIGHT_STATE_ON);
 	}
 	else if(evts & MAIN_EVT_BLE_DEVICE_AUTHENTICATED){
-		toggle_output(OUTPUT_MSG_TYPE_TOGGLE_TAG_AUTHENTICATED, LIGHT_STATE_ON);
-		toggle_output(OUTPUT_MSG_TYPE_TOGGLE_OVERHEAD_LIGHT, LIGHT_STATE_OFF);
+		toggle_output(door, OUTPUT_MSG_TYPE_TOGGLE_TAG_AUTHENTICATED, LIGHT_STATE_ON);
+		toggle_output(door, OUTPUT_MSG_TYPE_TOGGLE_OVERHEAD_LIGHT, LIGHT_STATE_OFF);
 		// TODO authenticated!
 	}
 	else if(evts & MAIN_EVT_BLE_DEVICE_AUTHENTICATION_FAIL){
-		toggle_output(OUTPUT_MSG_TOGGLE_TAG_AUTHENTICATION_FAIL, LIGHT_STATE_ON);
-		toggle_output(OUTPUT_MSG_TYPE_TOGGLE_OVERHEAD_LIGHT, LIGHT_STATE_OFF);
+		toggle_output(door, OUTPUT_MSG_TOGGLE_TAG_AUTHENTICATION_FAIL, LIGHT_STATE_ON);
+		toggle_output(door, OUTPUT_MSG_TYPE_TOGGLE_OVERHEAD_LIGHT, LIGHT_STATE_OFF);
 		// TODO authentication fail
 	}
 
-	update_authentication_state(BLE_MSG_TYPE_STOP_AUTHENTICATION);
-	toggle_output(OUTPUT_MSG_TYPE_TOGGLE_LED, LED_STATE_OFF);
+	update_authentication_state(BLE_MSG_TYPE_STOP_AUTHENTICATION, door);
+	toggle_output(door, OUTPUT_MSG_TYPE_TOGGLE_LED, LED_STATE_OFF);
 }
 
 void main()
 {
 	LOG_DBG("Start main thread");
 
-	if(input_init()){
-		return;
-	}
-
 	uint32_t evts = 0;
 	
 	while(1){
-		evts = k_event_wait(&main_evts, MAIN_EVT_BLE_DEVICE_FOUND | MAIN_EVT_BTN_PRESSED, true, K_SECONDS(DEFAULT_TIMEOUT_FOR_SCANS_SECONDS));
+		// presses from before main started or during an authentication are
+		// still pending, the wait below would clear their event
+		if(input_door_pressed()){
+			evts = MAIN_EVT_BTN_PRESSED;
+		}
+		else{
+			evts = k_event_wait(&main_evts, MAIN_EVT_BLE_DEVICE_FOUND | MAIN_EVT_BTN_PRESSED, true, K_SECONDS(DEFAULT_TIMEOUT_FOR_SCANS_SECONDS));
+		}
 		if(!evts){
 			LOG_INF("Scan timeout");
 		}
 		else if(evts & MAIN_EVT_BLE_DEVICE_FOUND){
-			toggle_output(OUTPUT_MSG_TYPE_TOGGLE_OVERHEAD_LIGHT, LIGHT_STATE_ON);
+			scan_stats_presence_handled();
+			// light only the doors the tag's group may open now
+			uint32_t doors = ble_take_presence_doors() & BIT_MASK(OUTPUT_DOOR_COUNT);
+			while(doors){
+				int door = find_lsb_set(doors) - 1;
+				doors &= ~BIT(door);
+
+				toggle_output(door, OUTPUT_MSG_TYPE_TOGGLE_OVERHEAD_LIGHT, LIGHT_STATE_ON);
+			}
 		}
 		else if(evts & MAIN_EVT_BTN_PRESSED){
-			LOG_INF("BTN pressed, start authentication");
+			uint32_t doors = input_take_pressed_doors();
+			while(doors){
+				int door = find_lsb_set(doors) - 1;
+				doors &= ~BIT(door);
+
+				LOG_INF("BTN pressed (door %d), start authentication", door);
 
-			toggle_output(OUTPUT_MSG_TYPE_TOGGLE_LED, LED_STATE_ON);
-			update_authentication_state(BLE_MSG_TYPE_ENABLE_AUTHENTICATION);
-			wait_authentication();
+				toggle_output(door, OUTPUT_MSG_TYPE_TOGGLE_LED, LED_STATE_ON);
+				update_authentication_state(BLE_MSG_TYPE_ENABLE_AUTHENTICATION, door);
+				wait_authentication(door);
+			}
 		}
 	}
 }
\ No newline at end of file
@@ -10,8 +10,11 @@
 #include "output.h"
 #include "storage.h"
 #include "ble.h"
-
-#define DEFAULT_ADDR_FILTER_LEN             25
+#include "uart_stream.h"
+#include "workq.h"
+#include "startup.h"
+#include "scan_stats.h"
+#include "rules.h"
 
 #define DEFAULT_TIMEOUT_FOR_SCANS_SECONDS   10
 
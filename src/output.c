@@ -1,46 +1,66 @@
 #include "output.h"
 
 #include <zephyr/drivers/gpio.h>
+#include <zephyr/init.h>
 #include <zephyr/logging/log.h>
 
 LOG_MODULE_REGISTER(OUTPUT);
 
 #define DEFAULT_TIMEOUT_FOR_LIGHT_SECONDS           (5 * 60)
 
-#define LED_LIGHT_NODE                              DT_NODELABEL(led)
-#define OVERHEAD_LIGHT_NODE                         DT_NODELABEL(out1)
-#define AUTHENTICATED_LIGHT_NODE                    DT_NODELABEL(out2)
-#define AUTHENTICATION_FAIL_LIGHT_NODE              DT_NODELABEL(out3)
+#define OUTPUTS_NODE                                DT_PATH(outputs)
 
 struct output_light{
     struct gpio_dt_spec gpio_spec;
     int current_state;
 };
 
-static void overhead_light_timer_exp_cb(struct k_timer *timer);
-
-K_MSGQ_DEFINE(output_msgq, sizeof(struct output_msg), 5, 4);
-K_TIMER_DEFINE(overhead_light_timer, overhead_light_timer_exp_cb, NULL);
-
-struct output_light overhead_light = {
-    .current_state = 0,
-    .gpio_spec = GPIO_DT_SPEC_GET(OVERHEAD_LIGHT_NODE, gpios)  
-};
-
-struct output_light authenticated_light = {
-    .current_state = 0,
-    .gpio_spec = GPIO_DT_SPEC_GET(AUTHENTICATED_LIGHT_NODE, gpios)  
+// One output_light per child of the outputs node
+#define OUTPUT_LIGHT_DEFINE(node)                                           \
+    BUILD_ASSERT(DT_PROP(node, door) < OUTPUT_DOOR_COUNT,                   \
+        "Output door index out of range");                                  \
+    static struct output_light DT_CAT(output_light_, node) = {              \
+        .current_state = 0,                                                 \
+        .gpio_spec = GPIO_DT_SPEC_GET(node, gpios)                          \
+    };
+
+// Number of outputs nodes with door d and role r
+#define OUTPUT_SLOT_MATCH(node, d, r)                                       \
+    + ((DT_PROP(node, door) == (d)) && (DT_ENUM_IDX(node, role) == (r)))
+#define OUTPUT_SLOT_COUNT(d, r)                                             \
+    (0 DT_FOREACH_CHILD_VARGS(OUTPUTS_NODE, OUTPUT_SLOT_MATCH, d, r))
+
+// Every door has exactly one output of each role, duplicates would
+// silently overwrite each other in light_table
+#define OUTPUT_DOOR_CHECK(d, ...)                                           \
+    BUILD_ASSERT(OUTPUT_SLOT_COUNT(d, 0) == 1 && OUTPUT_SLOT_COUNT(d, 1) == 1 && \
+        OUTPUT_SLOT_COUNT(d, 2) == 1 && OUTPUT_SLOT_COUNT(d, 3) == 1,       \
+        "Each door needs exactly one overhead, led, authenticated and auth-fail output");
+
+BUILD_ASSERT(OUTPUT_MSG_LIGHT_TYPES == 4, "Update OUTPUT_DOOR_CHECK for the light types");
+LISTIFY(OUTPUT_DOOR_COUNT, OUTPUT_DOOR_CHECK, ())
+
+#define OUTPUT_LIGHT_TABLE_ENTRY(node)                                      \
+    [DT_PROP(node, door)][DT_ENUM_IDX(node, role)] = &DT_CAT(output_light_, node),
+
+#define OUTPUT_LIGHT_LIST_ENTRY(node)                                       \
+    &DT_CAT(output_light_, node),
+
+// presence turns on the overhead light of every door at once
+K_MSGQ_DEFINE(output_msgq, sizeof(struct output_msg), 4 + OUTPUT_DOOR_COUNT, 4);
+
+DT_FOREACH_CHILD(OUTPUTS_NODE, OUTPUT_LIGHT_DEFINE)
+
+// [door][light type] -> light, NULL where a door has no output of that type
+static struct output_light *const light_table[OUTPUT_DOOR_COUNT][OUTPUT_MSG_LIGHT_TYPES] = {
+    DT_FOREACH_CHILD(OUTPUTS_NODE, OUTPUT_LIGHT_TABLE_ENTRY)
 };
 
-struct output_light authentication_fail_light = {
-    .current_state = 0,
-    .gpio_spec = GPIO_DT_SPEC_GET(AUTHENTICATION_FAIL_LIGHT_NODE, gpios)  
+static struct output_light *const lights[] = {
+    DT_FOREACH_CHILD(OUTPUTS_NODE, OUTPUT_LIGHT_LIST_ENTRY)
 };
 
-struct output_light led_light = {
-    .current_state = 0,
-    .gpio_spec = GPIO_DT_SPEC_GET(LED_LIGHT_NODE, gpios)
-};
+static struct k_timer overhead_light_timers[OUTPUT_DOOR_COUNT];
 
 uint16_t overhead_light_on_timeout_seconds = DEFAULT_TIMEOUT_FOR_LIGHT_SECONDS;
 
@@ -73,67 +93,112 @@ static void toggle_light(struct output_light *light, int state)
 
 static void overhead_light_timer_exp_cb(struct k_timer *timer)
 {
-    toggle_light(&overhead_light, 0);
-    k_timer_stop(&overhead_light_timer);
+    int door = timer - overhead_light_timers;
+    toggle_light(light_table[door][OUTPUT_MSG_TYPE_TOGGLE_OVERHEAD_LIGHT], 0);
+    k_timer_stop(timer);
+    uart_stream_output_changed(door, OUTPUT_MSG_TYPE_TOGGLE_OVERHEAD_LIGHT, 0);
 }
 
-void output_thread_main()
+static int output_init()
 {
-    LOG_DBG("Start output thread");
+    for(int i=0; i<ARRAY_SIZE(lights); ++i){
+        if(init_light(lights[i], LIGHT_STATE_OFF)){
+            return -ENODEV;
+        }
+    }
 
-    if(init_light(&led_light, LED_STATE_OFF)){
+    for(int i=0; i<OUTPUT_DOOR_COUNT; ++i){
+        k_timer_init(&overhead_light_timers[i], overhead_light_timer_exp_cb, NULL);
+    }
+
+    startup_milestone(STARTUP_OUTPUTS_READY);
+    return 0;
+}
+
+static void output_handle_msg(const struct output_msg *msg)
+{
+    LOG_INF("Output msg received(door: %d type: %d state: %d)", msg->door, msg->type, msg->state);
+    if(msg->type == OUTPUT_MSG_TYPE_SET_OVERHEAD_LIGHT_TIMEOUT){
+        overhead_light_on_timeout_seconds = msg->state;
+        LOG_DBG("Overhead light timeout %d s", msg->state);
         return;
     }
 
-    if(init_light(&overhead_light, LIGHT_STATE_OFF)){
+    if(msg->door < 0 || msg->door >= OUTPUT_DOOR_COUNT || msg->type < 0 || msg->type >= OUTPUT_MSG_LIGHT_TYPES){
+        LOG_WRN("Invalid output msg");
         return;
     }
 
-    if(init_light(&authenticated_light, LIGHT_STATE_OFF)){
+    struct output_light *light = light_table[msg->door][msg->type];
+    if(light == NULL){
         return;
     }
 
-    if(init_light(&authentication_fail_light, LIGHT_STATE_OFF)){
+    toggle_light(light, msg->state);
+    if(msg->type == OUTPUT_MSG_TYPE_TOGGLE_OVERHEAD_LIGHT){
+        if(msg->state == 0){
+            k_timer_stop(&overhead_light_timers[msg->door]);
+        }
+        else{
+            k_timer_start(&overhead_light_timers[msg->door], K_SECONDS(overhead_light_on_timeout_seconds), K_NO_WAIT);
+        }
+    }
+
+    uart_stream_output_changed(msg->door, msg->type, msg->state);
+}
+
+#if defined(CONFIG_APP_WORKQUEUE)
+
+static void output_work_handler(struct k_work *work)
+{
+    struct output_msg msg;
+    while(k_msgq_get(&output_msgq, &msg, K_NO_WAIT) == 0){
+        output_handle_msg(&msg);
+    }
+}
+
+K_WORK_DEFINE(output_work, output_work_handler);
+
+static int output_sys_init(const struct device *dev)
+{
+    ARG_UNUSED(dev);
+
+    LOG_DBG("Init outputs");
+    return output_init();
+}
+
+SYS_INIT(output_sys_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+
+#else
+
+void output_thread_main()
+{
+    LOG_DBG("Start output thread");
+
+    if(output_init()){
         return;
     }
 
     struct output_msg msg;
     while(1){
         k_msgq_get(&output_msgq, &msg, K_FOREVER);
-        LOG_INF("Output msg received(type: %d state: %d)", msg.type, msg.state);
-        switch(msg.type){
-            case OUTPUT_MSG_TYPE_TOGGLE_OVERHEAD_LIGHT:{
-                toggle_light(&overhead_light, msg.state);
-                if(msg.state == 0){
-                    k_timer_stop(&overhead_light_timer);
-                }
-                else{
-                    k_timer_start(&overhead_light_timer, K_SECONDS(overhead_light_on_timeout_seconds), K_NO_WAIT);
-                }
-
-                LOG_DBG("Toggle overhead light %d", msg.state);
-                break;
-            }
-            case OUTPUT_MSG_TYPE_TOGGLE_LED:{
-                toggle_light(&led_light, msg.state);
-                LOG_DBG("Toggle LED %d", msg.state);
-                break;
-            }
-            case OUTPUT_MSG_TYPE_TOGGLE_TAG_AUTHENTICATED:{
-                toggle_light(&authenticated_light, msg.state);
-                LOG_DBG("Toggle authenticated light %d", msg.state);
-                break;
-            }
-            case OUTPUT_MSG_TOGGLE_TAG_AUTHENTICATION_FAIL:{
-                toggle_light(&authentication_fail_light, msg.state);
-                LOG_DBG("Toggle authentication fail light %d", msg.state);
-                break;
-            }
-            default:{
-                break;
-            }
-        }
+        output_handle_msg(&msg);
     }
 }
 
-K_THREAD_DEFINE(output_thread, 1024, output_thread_main, NULL, NULL, NULL, 2, K_ESSENTIAL, 0);
\ No newline at end of file
+K_THREAD_DEFINE(output_thread, CONFIG_APP_OUTPUT_THREAD_STACK_SIZE, output_thread_main, NULL, NULL, NULL, 2, K_ESSENTIAL, 0);
+
+#endif
+
+int output_post(const struct output_msg *msg)
+{
+    int res = k_msgq_put(&output_msgq, msg, K_NO_WAIT);
+
+#if defined(CONFIG_APP_WORKQUEUE)
+    if(!res){
+        k_work_submit_to_queue(&app_workq, &output_work);
+    }
+#endif
+
+    return res;
+}
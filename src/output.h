@@ -9,18 +9,30 @@
 #define LIGHT_STATE_ON                  1
 #define LIGHT_STATE_OFF                 0
 
+#define OUTPUT_DOOR_COUNT               DT_PROP(DT_PATH(outputs), door_count)
+
 enum output_msg_types{
     OUTPUT_MSG_TYPE_TOGGLE_OVERHEAD_LIGHT, 
     OUTPUT_MSG_TYPE_TOGGLE_LED, 
     OUTPUT_MSG_TYPE_TOGGLE_TAG_AUTHENTICATED, 
-    OUTPUT_MSG_TOGGLE_TAG_AUTHENTICATION_FAIL
+    OUTPUT_MSG_TOGGLE_TAG_AUTHENTICATION_FAIL,
+    // light types above are indexed by the devicetree "role" of each output
+    OUTPUT_MSG_LIGHT_TYPES,
+    OUTPUT_MSG_TYPE_SET_OVERHEAD_LIGHT_TIMEOUT = OUTPUT_MSG_LIGHT_TYPES,     // state carries the timeout in seconds
 };
 
 struct output_msg{
     int type;
     int state;
+    int door;
 };
 
-void output_thread_main();
+/**
+ * @brief Queue a message for the outputs
+ * 
+ * @param msg message to queue
+ * @return 0 on success, -ENOMSG if the output queue is full
+ */
+int output_post(const struct output_msg *msg);
 
-#endif
\ No newline at end of file
+#endif
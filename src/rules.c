@@ -0,0 +1,199 @@
+#include "rules.h"
+#include "startup.h"
+
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(RULES);
+
+#define SECONDS_PER_DAY                 86400
+#define SECONDS_PER_QUARTER             900
+#define QUARTER_WORDS                   (RULES_QUARTERS_PER_DAY / 32)
+
+// 1970-01-01 was a Thursday, Monday = 0
+#define EPOCH_WEEKDAY                   3
+
+struct rule_schedule{
+    uint32_t quarters[RULES_DAYS][QUARTER_WORDS];
+};
+
+struct rule_set{
+    atomic_t readers;
+    uint16_t holiday_base;
+    uint32_t holidays[RULES_HOLIDAY_DAYS / 32];
+    uint32_t group_doors[CONFIG_APP_RULES_MAX_GROUPS];
+    uint8_t group_schedule[CONFIG_APP_RULES_MAX_GROUPS];
+    struct rule_schedule schedules[CONFIG_APP_RULES_MAX_SCHEDULES];
+};
+
+BUILD_ASSERT(OUTPUT_DOOR_COUNT < 32, "Door masks are 32 bits");
+
+static struct rule_set rule_sets[2];
+static struct rule_set *pending = &rule_sets[0];
+// set by rules_begin(), cleared by rules_commit()
+static bool pending_open;
+// NULL until the first commit since boot, see rules_allowed_doors()
+static atomic_ptr_t active = ATOMIC_PTR_INIT(NULL);
+
+// local time = uptime + offset, 0 while the clock is unknown
+static atomic_t time_offset = ATOMIC_INIT(0);
+
+static struct rule_set *acquire_rules()
+{
+    while(1){
+        struct rule_set *set = atomic_ptr_get(&active);
+        if(set == NULL){
+            return NULL;
+        }
+
+        atomic_inc(&set->readers);
+        // recheck, the writer may have retired this set meanwhile
+        if(atomic_ptr_get(&active) == set){
+            return set;
+        }
+        atomic_dec(&set->readers);
+    }
+}
+
+static void release_rules(struct rule_set *set)
+{
+    atomic_dec(&set->readers);
+}
+
+// rules can grant access once committed and the clock is known
+static void check_rules_ready()
+{
+    if(atomic_ptr_get(&active) != NULL && atomic_get(&time_offset) != 0){
+        startup_milestone(STARTUP_RULES_READY);
+    }
+}
+
+int rules_begin(uint16_t holiday_base)
+{
+    // the set retired by the last commit may still be read by an evaluation
+    while(atomic_get(&pending->readers)){
+        k_yield();
+    }
+
+    memset(pending->holidays, 0, sizeof(pending->holidays));
+    memset(pending->group_doors, 0, sizeof(pending->group_doors));
+    memset(pending->group_schedule, 0, sizeof(pending->group_schedule));
+    memset(pending->schedules, 0, sizeof(pending->schedules));
+    pending->holiday_base = holiday_base;
+    pending_open = true;
+
+    return 0;
+}
+
+int rules_add_schedule_range(uint8_t schedule, uint8_t day_mask, uint8_t start, uint8_t end)
+{
+    if(!pending_open || schedule >= CONFIG_APP_RULES_MAX_SCHEDULES || start >= end ||
+        end > RULES_QUARTERS_PER_DAY){
+        return -EINVAL;
+    }
+
+    struct rule_schedule *sched = &pending->schedules[schedule];
+    for(int day=0; day<RULES_DAYS; ++day){
+        if(!(day_mask & BIT(day))){
+            continue;
+        }
+
+        for(int q=start; q<end; ++q){
+            sched->quarters[day][q / 32] |= BIT(q % 32);
+        }
+    }
+
+    return 0;
+}
+
+int rules_set_group(uint8_t group, uint8_t schedule, uint32_t door_mask)
+{
+    if(!pending_open || group >= CONFIG_APP_RULES_MAX_GROUPS || schedule >= CONFIG_APP_RULES_MAX_SCHEDULES){
+        return -EINVAL;
+    }
+
+    pending->group_schedule[group] = schedule;
+    pending->group_doors[group] = door_mask;
+
+    return 0;
+}
+
+int rules_add_holiday(uint16_t day)
+{
+    uint16_t idx = day - pending->holiday_base;
+    if(!pending_open || day < pending->holiday_base || idx >= RULES_HOLIDAY_DAYS){
+        return -EINVAL;
+    }
+
+    pending->holidays[idx / 32] |= BIT(idx % 32);
+
+    return 0;
+}
+
+int rules_commit()
+{
+    // a repeated commit would bring back the previous generation
+    if(!pending_open){
+        return -EINVAL;
+    }
+
+    // store the marker first: if this fails the rules are not activated, so
+    // a reset can never open doors that these rules would have locked
+    int res = storage_set_rules_configured();
+    if(res){
+        return res;
+    }
+
+    struct rule_set *retired = atomic_ptr_get(&active);
+
+    atomic_ptr_set(&active, pending);
+    pending = (pending == &rule_sets[0]) ? &rule_sets[1] : &rule_sets[0];
+    pending_open = false;
+
+    LOG_INF("Rules committed%s", retired ? "" : ", access now scheduled");
+    check_rules_ready();
+    return 0;
+}
+
+void rules_set_time(uint32_t local_seconds)
+{
+    atomic_set(&time_offset, (atomic_val_t)(local_seconds - (uint32_t)(k_uptime_get() / 1000)));
+    LOG_INF("Local time set to %u", local_seconds);
+    check_rules_ready();
+}
+
+uint32_t rules_allowed_doors(uint8_t group)
+{
+    struct rule_set *set = acquire_rules();
+    if(set == NULL){
+        // rules are RAM only: after a reset on a configured reader, deny
+        // until the gateway commits them again
+        return storage_rules_configured() ? 0 : BIT_MASK(OUTPUT_DOOR_COUNT);
+    }
+
+    uint32_t doors = 0;
+    uint32_t offset = (uint32_t)atomic_get(&time_offset);
+    if(offset == 0 || group >= CONFIG_APP_RULES_MAX_GROUPS){
+        // no wall clock, or group not in the rules: deny
+        release_rules(set);
+        return 0;
+    }
+
+    uint32_t now = (uint32_t)(k_uptime_get() / 1000) + offset;
+    uint32_t days = now / SECONDS_PER_DAY;
+    uint32_t q = (now % SECONDS_PER_DAY) / SECONDS_PER_QUARTER;
+
+    uint32_t day = (days + EPOCH_WEEKDAY) % 7;
+    uint32_t holiday_idx = days - set->holiday_base;
+    if(days >= set->holiday_base && holiday_idx < RULES_HOLIDAY_DAYS &&
+        (set->holidays[holiday_idx / 32] & BIT(holiday_idx % 32))){
+        day = RULES_HOLIDAY;
+    }
+
+    const struct rule_schedule *sched = &set->schedules[set->group_schedule[group]];
+    if(sched->quarters[day][q / 32] & BIT(q % 32)){
+        doors = set->group_doors[group];
+    }
+
+    release_rules(set);
+    return doors;
+}
@@ -0,0 +1,84 @@
+#ifndef RULES_H
+#define RULES_H
+
+#include "main.h"
+
+#define RULES_QUARTERS_PER_DAY              96
+// 7 weekdays, Monday first, then the holiday row
+#define RULES_DAYS                          8
+#define RULES_HOLIDAY                       7
+#define RULES_HOLIDAY_DAYS                  384
+
+/*
+ * Rules are built into a pending set by rules_begin() and the rules_add/set
+ * calls, then swapped in with rules_commit(). On a reader that never had
+ * rules committed, every allowlisted tag is allowed on every door until the
+ * first commit. Once rules have been committed, a reset denies every door
+ * until rules are committed again.
+ */
+
+/**
+ * @brief Start building a new rule set
+ * 
+ * Required before the rules_add/set calls and rules_commit().
+ * 
+ * @param holiday_base first day (days since 1970-01-01) the holiday bitmap covers
+ * @return 0 on success
+ */
+int rules_begin(uint16_t holiday_base);
+
+/**
+ * @brief Allow a schedule over a range of quarter hours
+ * 
+ * @param schedule schedule index
+ * @param day_mask bit n for weekday n (Monday = 0), RULES_HOLIDAY bit for holidays
+ * @param start first quarter hour of the day, 0 to 95
+ * @param end quarter hour after the last, up to 96
+ * @return 0 on success, -EINVAL on bad arguments or without rules_begin()
+ */
+int rules_add_schedule_range(uint8_t schedule, uint8_t day_mask, uint8_t start, uint8_t end);
+
+/**
+ * @brief Set the schedule and doors of a group
+ * 
+ * @param group group index
+ * @param schedule schedule index
+ * @param door_mask bit n for door n
+ * @return 0 on success, -EINVAL on bad arguments or without rules_begin()
+ */
+int rules_set_group(uint8_t group, uint8_t schedule, uint32_t door_mask);
+
+/**
+ * @brief Mark a day as holiday
+ * 
+ * @param day days since 1970-01-01
+ * @return 0 on success, -EINVAL if outside the holiday bitmap or without rules_begin()
+ */
+int rules_add_holiday(uint16_t day);
+
+/**
+ * @brief Atomically replace the active rule set with the pending one
+ * 
+ * The first commit stores the rules configured marker before the swap.
+ * 
+ * @return 0 on success, -EINVAL if rules_begin() was not called since the
+ * last commit, or the marker save error, in which case nothing is activated
+ */
+int rules_commit();
+
+/**
+ * @brief Set local wall clock time
+ * 
+ * @param local_seconds local time in seconds since 1970-01-01
+ */
+void rules_set_time(uint32_t local_seconds);
+
+/**
+ * @brief Get the doors a group may open now
+ * 
+ * @param group group index of the allowlist entry
+ * @return bit n set if door n may be opened
+ */
+uint32_t rules_allowed_doors(uint8_t group);
+
+#endif
@@ -0,0 +1,243 @@
+#include "scan_stats.h"
+
+#include <zephyr/init.h>
+#include <zephyr/logging/log.h>
+#if defined(CONFIG_APP_SCAN_STATS_BENCH)
+#include <zephyr/timing/timing.h>
+#endif
+
+LOG_MODULE_REGISTER(SCAN_STATS);
+
+struct scan_counters{
+    uint32_t adv;
+    uint32_t allowlisted;
+    uint32_t presence;
+};
+
+// Synthetic tags simulated by stress/adv_flood, C0:DE:00:00:00:00 + n
+#define FLOOD_TAG_ADDR(n)               {.type = BT_ADDR_LE_RANDOM, .a.val = {(n), 0x00, 0x00, 0x00, 0xde, 0xc0}}
+
+// Benchmark addresses BE:4C:00:00:00:00 + n in the filter, BE:4D:... not
+#define BENCH_ADDR(n, miss)             {.type = BT_ADDR_LE_RANDOM, \
+                                         .a.val = {(n) & 0xff, (n) >> 8, 0x00, 0x00, (miss) ? 0x4d : 0x4c, 0xbe}}
+#define BENCH_LOOKUPS                   10000
+// time for the gateway to commit rules and set the clock, so the rule
+// evaluation being timed is the scheduled one
+#define BENCH_DELAY_MS                  10000
+
+// Sighting of one synthetic tag
+struct tag_sighting{
+    bt_addr_le_t addr;
+    uint64_t first_seen_us;
+    uint64_t last_seen_us;
+    bool pending;
+};
+
+static atomic_t adv_count = ATOMIC_INIT(0);
+static atomic_t allowlisted_count = ATOMIC_INIT(0);
+static atomic_t presence_count = ATOMIC_INIT(0);
+
+// by synthetic tag number, written from the BT RX thread and read by main
+// when presence is handled
+static struct tag_sighting sightings[MAX(CONFIG_APP_SCAN_STATS_ALLOWLIST_LEN, 1)];
+static struct k_spinlock sightings_lock;
+
+static struct scan_counters last;
+static int64_t last_report_ms;
+
+#if defined(CONFIG_SCHED_THREAD_USAGE_ALL)
+static k_thread_runtime_stats_t last_runtime;
+#endif
+
+static void report_work_handler(struct k_work *work);
+
+K_WORK_DELAYABLE_DEFINE(report_work, report_work_handler);
+
+#if defined(CONFIG_APP_SCAN_STATS_BENCH)
+static void bench_work_handler(struct k_work *work);
+
+K_WORK_DELAYABLE_DEFINE(bench_work, bench_work_handler);
+#endif
+
+static uint64_t uptime_us()
+{
+    return k_ticks_to_us_floor64(k_uptime_ticks());
+}
+
+// Synthetic tag number of addr, -1 for any other address
+static int flood_tag_idx(const bt_addr_le_t *addr)
+{
+    bt_addr_le_t tag = FLOOD_TAG_ADDR(addr->a.val[0]);
+
+    if(addr->a.val[0] >= CONFIG_APP_SCAN_STATS_ALLOWLIST_LEN || bt_addr_le_cmp(addr, &tag)){
+        return -1;
+    }
+
+    return addr->a.val[0];
+}
+
+void scan_stats_adv_received(const bt_addr_le_t *addr, bool allowlisted)
+{
+    atomic_inc(&adv_count);
+    if(!allowlisted){
+        return;
+    }
+
+    atomic_inc(&allowlisted_count);
+
+    int idx = flood_tag_idx(addr);
+    if(idx < 0){
+        return;
+    }
+
+    uint64_t now = uptime_us();
+    struct tag_sighting *tag = &sightings[idx];
+    k_spinlock_key_t key = k_spin_lock(&sightings_lock);
+
+    if(!tag->last_seen_us || bt_addr_le_cmp(&tag->addr, addr) ||
+        now - tag->last_seen_us > CONFIG_APP_SCAN_STATS_TAG_GAP_MS * 1000ULL){
+        bt_addr_le_copy(&tag->addr, addr);
+        tag->first_seen_us = now;
+        tag->pending = true;
+    }
+    tag->last_seen_us = now;
+
+    k_spin_unlock(&sightings_lock, key);
+}
+
+void scan_stats_presence_handled()
+{
+    atomic_inc(&presence_count);
+
+    uint64_t now = uptime_us();
+    for(int i=0; i<ARRAY_SIZE(sightings); ++i){
+        struct tag_sighting tag;
+
+        k_spinlock_key_t key = k_spin_lock(&sightings_lock);
+        tag = sightings[i];
+        sightings[i].pending = false;
+        k_spin_unlock(&sightings_lock, key);
+
+        if(!tag.pending){
+            continue;
+        }
+
+        char addr_str[BT_ADDR_LE_STR_LEN];
+        bt_addr_le_to_str(&tag.addr, addr_str, sizeof(addr_str));
+        LOG_INF("Tag %s seen at %llu us, presence handled at %llu us", addr_str, tag.first_seen_us, now);
+    }
+}
+
+static uint32_t per_second(uint32_t delta, int64_t elapsed_ms)
+{
+    return elapsed_ms > 0 ? (uint32_t)((uint64_t)delta * 1000 / elapsed_ms) : 0;
+}
+
+static void report_work_handler(struct k_work *work)
+{
+    struct scan_counters now = {
+        .adv = atomic_get(&adv_count),
+        .allowlisted = atomic_get(&allowlisted_count),
+        .presence = atomic_get(&presence_count),
+    };
+    int64_t now_ms = k_uptime_get();
+    int64_t elapsed_ms = now_ms - last_report_ms;
+
+    uint32_t load_permille = 0;
+#if defined(CONFIG_SCHED_THREAD_USAGE_ALL)
+    k_thread_runtime_stats_t runtime;
+    k_thread_runtime_stats_all_get(&runtime);
+    uint64_t busy = runtime.total_cycles - last_runtime.total_cycles;
+    uint64_t all = runtime.execution_cycles - last_runtime.execution_cycles;
+    load_permille = all ? (uint32_t)(busy * 1000 / all) : 0;
+    last_runtime = runtime;
+#endif
+
+    LOG_INF("scan: %u adv/s %u allowlisted/s %u presence/s load %u.%u%% (total adv %u allowlisted %u presence %u)",
+        per_second(now.adv - last.adv, elapsed_ms),
+        per_second(now.allowlisted - last.allowlisted, elapsed_ms),
+        per_second(now.presence - last.presence, elapsed_ms),
+        load_permille / 10, load_permille % 10,
+        now.adv, now.allowlisted, now.presence);
+
+    last = now;
+    last_report_ms = now_ms;
+    k_work_schedule(&report_work, K_MSEC(CONFIG_APP_SCAN_STATS_INTERVAL_MS));
+}
+
+#if defined(CONFIG_APP_SCAN_STATS_BENCH)
+
+// CPU cycles for BENCH_LOOKUPS lookups + rule evaluations
+static uint64_t bench_lookups(int entries, bool miss)
+{
+    uint32_t doors = 0;
+    timing_t start = timing_counter_get();
+
+    for(int i=0; i<BENCH_LOOKUPS; ++i){
+        bt_addr_le_t addr = BENCH_ADDR(i % entries, miss);
+        uint8_t group;
+
+        if(ble_filter_lookup(&addr, &group) >= 0){
+            doors |= rules_allowed_doors(group);
+        }
+    }
+
+    timing_t end = timing_counter_get();
+    // keep the evaluation from being optimized out
+    LOG_DBG("Bench doors 0x%x", doors);
+
+    return timing_cycles_get(&start, &end);
+}
+
+static void bench_work_handler(struct k_work *work)
+{
+    int entries = 0;
+
+    // fill what the allowlist left free, spread over every rule group
+    while(entries < 0x10000){
+        bt_addr_le_t addr = BENCH_ADDR(entries, false);
+        if(ble_add_addr_to_filter(&addr, entries % CONFIG_APP_RULES_MAX_GROUPS)){
+            break;
+        }
+        entries++;
+    }
+    if(entries == 0){
+        LOG_WRN("Bench: address filter full, nothing to look up");
+        return;
+    }
+
+    // the kernel cycle counter is the 32 kHz RTC on nRF52, timing uses the CPU cycle counter
+    timing_init();
+    timing_start();
+    uint64_t hit = bench_lookups(entries, false);
+    uint64_t miss = bench_lookups(entries, true);
+    timing_stop();
+
+    LOG_INF("Bench: lookup + rules %u cycles (%u ns) in filter, %u cycles (%u ns) not in filter, "
+        "%d bench entries of %d, %d groups",
+        (uint32_t)(hit / BENCH_LOOKUPS), (uint32_t)(timing_cycles_to_ns(hit) / BENCH_LOOKUPS),
+        (uint32_t)(miss / BENCH_LOOKUPS), (uint32_t)(timing_cycles_to_ns(miss) / BENCH_LOOKUPS),
+        entries, CONFIG_APP_ALLOWLIST_MAX_LEN, CONFIG_APP_RULES_MAX_GROUPS);
+}
+
+#endif
+
+static int scan_stats_init(const struct device *dev)
+{
+    ARG_UNUSED(dev);
+
+    // allowlist the flood harness tags next to the built-in allowlist
+    for(int i=0; i<CONFIG_APP_SCAN_STATS_ALLOWLIST_LEN; ++i){
+        bt_addr_le_t addr = FLOOD_TAG_ADDR(i);
+        ble_add_addr_to_filter(&addr, 0);
+    }
+
+    last_report_ms = k_uptime_get();
+    k_work_schedule(&report_work, K_MSEC(CONFIG_APP_SCAN_STATS_INTERVAL_MS));
+#if defined(CONFIG_APP_SCAN_STATS_BENCH)
+    k_work_schedule(&bench_work, K_MSEC(BENCH_DELAY_MS));
+#endif
+    return 0;
+}
+
+SYS_INIT(scan_stats_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
@@ -0,0 +1,34 @@
+#ifndef SCAN_STATS_H
+#define SCAN_STATS_H
+
+#include "main.h"
+#include <zephyr/bluetooth/addr.h>
+
+#if defined(CONFIG_APP_SCAN_STATS)
+
+/**
+ * @brief Count a device_found() callback
+ * 
+ * A synthetic flood tag not seen for CONFIG_APP_SCAN_STATS_TAG_GAP_MS
+ * starts a new sighting, timed until the next presence event is handled.
+ * 
+ * @param addr advertiser address
+ * @param allowlisted true if the address is in the filter
+ */
+void scan_stats_adv_received(const bt_addr_le_t *addr, bool allowlisted);
+
+/**
+ * @brief Count a presence event handled by the main thread and log the
+ * sightings it covers
+ * 
+ */
+void scan_stats_presence_handled();
+
+#else
+
+static inline void scan_stats_adv_received(const bt_addr_le_t *addr, bool allowlisted) {}
+static inline void scan_stats_presence_handled() {}
+
+#endif
+
+#endif
@@ -0,0 +1,46 @@
+#include "startup.h"
+
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(STARTUP);
+
+#define STARTUP_UNLOCK_READY_MASK   (BIT(STARTUP_INPUTS_READY) | BIT(STARTUP_OUTPUTS_READY) | \
+                                     BIT(STARTUP_SCAN_STARTED) | BIT(STARTUP_ALLOWLIST_FIRST_ENTRY) | \
+                                     BIT(STARTUP_RULES_READY))
+
+static const char *const milestone_names[STARTUP_MILESTONES] = {
+    [STARTUP_INPUTS_READY] = "inputs ready",
+    [STARTUP_OUTPUTS_READY] = "outputs ready",
+    [STARTUP_BT_READY] = "bt ready",
+    [STARTUP_SCAN_STARTED] = "first scan",
+    [STARTUP_ALLOWLIST_FIRST_ENTRY] = "first allowlist entry",
+    [STARTUP_ALLOWLIST_LOADED] = "allowlist loaded",
+    [STARTUP_RULES_READY] = "access rules ready",
+    [STARTUP_UNLOCK_READY] = "first possible unlock",
+};
+
+static atomic_t milestones_done = ATOMIC_INIT(0);
+
+static void record_milestone(int milestone, uint32_t now)
+{
+    if(atomic_test_and_set_bit(&milestones_done, milestone)){
+        return;
+    }
+
+    LOG_INF("Boot to %s: %u ms", milestone_names[milestone], now);
+    uart_stream_boot_timing(milestone, now);
+}
+
+void startup_milestone(int milestone)
+{
+    uint32_t now = k_uptime_get_32();
+
+    if(milestone < 0 || milestone >= STARTUP_UNLOCK_READY){
+        return;
+    }
+
+    record_milestone(milestone, now);
+    if((atomic_get(&milestones_done) & STARTUP_UNLOCK_READY_MASK) == STARTUP_UNLOCK_READY_MASK){
+        record_milestone(STARTUP_UNLOCK_READY, now);
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include "main.h"
+
+enum startup_milestones{
+    STARTUP_INPUTS_READY,
+    STARTUP_OUTPUTS_READY,
+    STARTUP_BT_READY,
+    STARTUP_SCAN_STARTED,
+    STARTUP_ALLOWLIST_FIRST_ENTRY,
+    STARTUP_ALLOWLIST_LOADED,
+    // open access, or rules committed and the clock set
+    STARTUP_RULES_READY,
+    // inputs, outputs, scanning, rules and at least one allowlist entry are up
+    STARTUP_UNLOCK_READY,
+    STARTUP_MILESTONES,
+};
+
+/**
+ * @brief Record that a startup milestone was reached
+ * 
+ * Only the first call per milestone is recorded. Times are kernel uptime,
+ * which starts a few ms after reset.
+ * 
+ * @param milestone milestone reached
+ */
+void startup_milestone(int milestone);
+
+#endif
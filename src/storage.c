@@ -1,9 +1,113 @@
 #include "storage.h"
+#include "startup.h"
 
+#include <zephyr/init.h>
 #include <zephyr/logging/log.h>
+#include <zephyr/bluetooth/addr.h>
+#include <zephyr/settings/settings.h>
 
 LOG_MODULE_REGISTER(STORAGE);
 
+#define SETTINGS_SUBTREE                "ble_ac"
+#define RULES_CONFIGURED_KEY            "rules_configured"
+
+// cleared at boot once the stored marker is known to be absent
+static atomic_t rules_configured = ATOMIC_INIT(1);
+static bool rules_marker_found;
+
+// Allowlist built into the firmware, all in access rule group 0. Addresses
+// added over the uart stream live in the RAM filter only and are lost on
+// reset, the gateway adds them again.
+static const bt_addr_le_t stored_allowlist[] = {
+    {
+        .type = BT_ADDR_LE_RANDOM,
+        .a.val={0xfd, 0x20, 0x53, 0xc7, 0x4f, 0xfe},
+    },
+};
+
+int storage_read_allowlist_entry(int idx, bt_addr_le_t *addr, uint8_t *group)
+{
+    if(idx < 0){
+        return -ENOENT;
+    }
+
+    *group = 0;
+
+    if(idx < ARRAY_SIZE(stored_allowlist)){
+        bt_addr_le_copy(addr, &stored_allowlist[idx]);
+        return 0;
+    }
+
+    return -ENOENT;
+}
+
+bool storage_rules_configured()
+{
+    return atomic_get(&rules_configured) != 0;
+}
+
+int storage_set_rules_configured()
+{
+    uint8_t marker = 1;
+
+    if(rules_marker_found){
+        return 0;
+    }
+
+    int res = settings_save_one(SETTINGS_SUBTREE "/" RULES_CONFIGURED_KEY, &marker, sizeof(marker));
+    if(res){
+        LOG_ERR("Rules marker save fail (err %d)", res);
+        return res;
+    }
+
+    rules_marker_found = true;
+    atomic_set(&rules_configured, 1);
+    return 0;
+}
+
+static int storage_settings_set(const char *key, size_t len, settings_read_cb read_cb, void *cb_arg)
+{
+    if(strcmp(key, RULES_CONFIGURED_KEY) == 0){
+        rules_marker_found = true;
+    }
+
+    return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(storage, SETTINGS_SUBTREE, NULL, storage_settings_set, NULL, NULL);
+
+static int storage_init(const struct device *dev)
+{
+    ARG_UNUSED(dev);
+
+    int res = settings_subsys_init();
+    if(!res){
+        res = settings_load_subtree(SETTINGS_SUBTREE);
+    }
+    if(res){
+        // unknown state, doors stay locked until rules are committed
+        LOG_ERR("Settings load fail (err %d)", res);
+        return 0;
+    }
+
+    if(rules_marker_found){
+        LOG_WRN("Rules were committed before reset, doors locked until rules are committed again");
+    }
+    else{
+        atomic_clear(&rules_configured);
+        // never configured: open access, no rules needed to unlock
+        startup_milestone(STARTUP_RULES_READY);
+    }
+
+    return 0;
+}
+
+SYS_INIT(storage_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+
+#if !defined(CONFIG_APP_WORKQUEUE)
+
+// Nothing is stored yet. In workqueue mode there is no periodic storage
+// work, storage requests will be submitted to app_workq when added.
 void storage_thread_main()
 {
     LOG_DBG("Start storage thread");
@@ -12,4 +116,6 @@ void storage_thread_main()
     }
 }
 
-K_THREAD_DEFINE(storage_thread, 1024, storage_thread_main, NULL, NULL, NULL, 3, K_ESSENTIAL, 0);
\ No newline at end of file
+K_THREAD_DEFINE(storage_thread, CONFIG_APP_STORAGE_THREAD_STACK_SIZE, storage_thread_main, NULL, NULL, NULL, 3, K_ESSENTIAL, 0);
+
+#endif
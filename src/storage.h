@@ -2,6 +2,34 @@
 #define STORAGE_H
 
 #include "main.h"
+#include <zephyr/bluetooth/addr.h>
+
+/**
+ * @brief Read an entry of the allowlist built into the firmware
+ * 
+ * @param idx entry index
+ * @param addr read address
+ * @param group read access rule group
+ * @return 0 on success, -ENOENT past the last entry
+ */
+int storage_read_allowlist_entry(int idx, bt_addr_le_t *addr, uint8_t *group);
+
+/**
+ * @brief Check whether access rules were ever committed on this reader
+ * 
+ * Reads as true until the stored state has been loaded at boot, so callers
+ * fail closed.
+ * 
+ * @return true if rules were committed before, or if it is not known yet
+ */
+bool storage_rules_configured();
+
+/**
+ * @brief Record that access rules have been committed, survives resets
+ * 
+ * @return 0 on success
+ */
+int storage_set_rules_configured();
 
 void storage_thread_main();
 
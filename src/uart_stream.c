@@ -0,0 +1,465 @@
+#include "uart_stream.h"
+
+#include <zephyr/drivers/uart.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+
+LOG_MODULE_REGISTER(UART_STREAM);
+
+#define UART_STREAM_NODE                DT_NODELABEL(uart0)
+
+#define UART_STREAM_RX_TIMEOUT_US       1000
+
+#define UART_STREAM_ACK_OK              0
+
+struct tx_buf{
+    uint8_t data[CONFIG_APP_UART_STREAM_TX_BUF_SIZE];
+    size_t len;
+};
+
+struct rx_frame{
+    uint8_t data[UART_STREAM_MAX_ENCODED_LEN];
+    uint8_t len;
+};
+
+struct stream_stats{
+    uint32_t tx_frames;
+    uint32_t tx_dropped;
+    uint32_t rx_frames;
+    uint32_t rx_errors;
+};
+
+K_MSGQ_DEFINE(uart_stream_cmd_msgq, sizeof(struct rx_frame), CONFIG_APP_UART_STREAM_CMD_QUEUE_LEN, 4);
+
+static const struct device *stream_uart = DEVICE_DT_GET(UART_STREAM_NODE);
+
+// TX double buffer, one is filled while the other is owned by the DMA
+static struct tx_buf tx_bufs[2];
+static int tx_fill_idx;
+static bool tx_busy;
+static bool stream_ready;
+static uint16_t tx_seq;
+static struct k_spinlock tx_lock;
+
+// RX double buffer, handed to the driver alternately on buffer request
+static uint8_t rx_bufs[2][CONFIG_APP_UART_STREAM_RX_BUF_SIZE];
+static int rx_next_idx;
+static struct rx_frame rx_accum;
+
+static struct stream_stats stats;
+
+static size_t cobs_encode(const uint8_t *src, size_t len, uint8_t *dst)
+{
+    size_t read = 0;
+    size_t write = 1;
+    size_t code_idx = 0;
+    uint8_t code = 1;
+
+    while(read < len){
+        if(src[read] == 0){
+            dst[code_idx] = code;
+            code = 1;
+            code_idx = write++;
+            read++;
+            continue;
+        }
+
+        dst[write++] = src[read++];
+        code++;
+        if(code == 0xff){
+            dst[code_idx] = code;
+            code = 1;
+            code_idx = write++;
+        }
+    }
+
+    dst[code_idx] = code;
+    return write;
+}
+
+static int cobs_decode(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_len)
+{
+    size_t read = 0;
+    size_t write = 0;
+
+    while(read < len){
+        uint8_t code = src[read++];
+        if(code == 0){
+            return -EINVAL;
+        }
+
+        for(int i=1; i<code; ++i){
+            if(read >= len || write >= dst_len){
+                return -EINVAL;
+            }
+            dst[write++] = src[read++];
+        }
+
+        if(code != 0xff && read < len){
+            if(write >= dst_len){
+                return -EINVAL;
+            }
+            dst[write++] = 0;
+        }
+    }
+
+    return write;
+}
+
+// Must be called with tx_lock held
+static void start_tx_locked()
+{
+    struct tx_buf *buf = &tx_bufs[tx_fill_idx];
+    if(tx_busy || !stream_ready || buf->len == 0){
+        return;
+    }
+
+    int res = uart_tx(stream_uart, buf->data, buf->len, SYS_FOREVER_US);
+    if(res){
+        // Frames stay in the fill buffer and go out with the next kick
+        return;
+    }
+
+    tx_busy = true;
+    tx_fill_idx ^= 1;
+}
+
+int uart_stream_send(uint8_t type, const uint8_t *payload, size_t len)
+{
+    uint8_t frame[UART_STREAM_MAX_FRAME_LEN];
+    uint8_t encoded[UART_STREAM_MAX_ENCODED_LEN];
+
+    if(len > UART_STREAM_MAX_PAYLOAD_LEN){
+        return -EINVAL;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&tx_lock);
+
+    frame[0] = type;
+    sys_put_le16(tx_seq, &frame[1]);
+    sys_put_le32(k_uptime_get_32(), &frame[3]);
+    if(len){
+        memcpy(&frame[UART_STREAM_HDR_LEN], payload, len);
+    }
+    size_t frame_len = UART_STREAM_HDR_LEN + len;
+    sys_put_le16(crc16_itu_t(0xffff, frame, frame_len), &frame[frame_len]);
+    frame_len += UART_STREAM_CRC_LEN;
+
+    size_t enc_len = cobs_encode(frame, frame_len, encoded);
+    encoded[enc_len++] = 0;
+
+    struct tx_buf *buf = &tx_bufs[tx_fill_idx];
+    if(buf->len + enc_len > sizeof(buf->data)){
+        // consume the seq so the gateway sees the drop as a gap
+        tx_seq++;
+        stats.tx_dropped++;
+        k_spin_unlock(&tx_lock, key);
+        return -ENOMEM;
+    }
+
+    memcpy(&buf->data[buf->len], encoded, enc_len);
+    buf->len += enc_len;
+    tx_seq++;
+    stats.tx_frames++;
+
+    start_tx_locked();
+    k_spin_unlock(&tx_lock, key);
+
+    return 0;
+}
+
+void uart_stream_presence(const bt_addr_le_t *addr, int8_t rssi)
+{
+    uint8_t payload[sizeof(addr->a.val) + 2];
+
+    payload[0] = addr->type;
+    memcpy(&payload[1], addr->a.val, sizeof(addr->a.val));
+    payload[sizeof(payload) - 1] = (uint8_t)rssi;
+
+    uart_stream_send(UART_STREAM_EVT_PRESENCE, payload, sizeof(payload));
+}
+
+void uart_stream_auth_stage(int stage, uint32_t duration_ms, int err)
+{
+    uint8_t payload[7];
+
+    payload[0] = (uint8_t)stage;
+    sys_put_le32(duration_ms, &payload[1]);
+    sys_put_le16((uint16_t)(int16_t)err, &payload[5]);
+
+    uart_stream_send(UART_STREAM_EVT_AUTH_STAGE, payload, sizeof(payload));
+}
+
+void uart_stream_output_changed(int door, int type, int state)
+{
+    uint8_t payload[3] = {(uint8_t)door, (uint8_t)type, (uint8_t)state};
+
+    uart_stream_send(UART_STREAM_EVT_OUTPUT, payload, sizeof(payload));
+}
+
+void uart_stream_boot_timing(int milestone, uint32_t uptime_ms)
+{
+    uint8_t payload[5];
+
+    payload[0] = (uint8_t)milestone;
+    sys_put_le32(uptime_ms, &payload[1]);
+
+    uart_stream_send(UART_STREAM_EVT_BOOT_TIMING, payload, sizeof(payload));
+}
+
+static void send_stats()
+{
+    uint8_t payload[16];
+
+    sys_put_le32(stats.tx_frames, &payload[0]);
+    sys_put_le32(stats.tx_dropped, &payload[4]);
+    sys_put_le32(stats.rx_frames, &payload[8]);
+    sys_put_le32(stats.rx_errors, &payload[12]);
+
+    uart_stream_send(UART_STREAM_EVT_STATS, payload, sizeof(payload));
+}
+
+static void send_ack(uint8_t cmd, uint16_t cmd_seq, int result)
+{
+    uint8_t payload[5];
+
+    payload[0] = cmd;
+    sys_put_le16(cmd_seq, &payload[1]);
+    sys_put_le16((uint16_t)(int16_t)result, &payload[3]);
+
+    uart_stream_send(UART_STREAM_EVT_ACK, payload, sizeof(payload));
+}
+
+static void rx_bytes(const uint8_t *data, size_t len)
+{
+    for(size_t i=0; i<len; ++i){
+        if(data[i] != 0){
+            if(rx_accum.len < sizeof(rx_accum.data)){
+                rx_accum.data[rx_accum.len] = data[i];
+            }
+            // keep counting so oversized frames get rejected at the delimiter
+            if(rx_accum.len < UINT8_MAX){
+                rx_accum.len++;
+            }
+            continue;
+        }
+
+        if(rx_accum.len == 0){
+            continue;
+        }
+
+        if(rx_accum.len > sizeof(rx_accum.data) ||
+            k_msgq_put(&uart_stream_cmd_msgq, &rx_accum, K_NO_WAIT)){
+            stats.rx_errors++;
+        }
+        rx_accum.len = 0;
+    }
+}
+
+static void uart_cb(const struct device *dev, struct uart_event *evt, void *user_data)
+{
+    switch(evt->type){
+        case UART_TX_DONE:
+        case UART_TX_ABORTED:{
+            k_spinlock_key_t key = k_spin_lock(&tx_lock);
+            // the buffer just sent is the one not being filled
+            tx_bufs[tx_fill_idx ^ 1].len = 0;
+            tx_busy = false;
+            start_tx_locked();
+            k_spin_unlock(&tx_lock, key);
+            break;
+        }
+        case UART_RX_RDY:{
+            rx_bytes(&evt->data.rx.buf[evt->data.rx.offset], evt->data.rx.len);
+            break;
+        }
+        case UART_RX_BUF_REQUEST:{
+            uart_rx_buf_rsp(dev, rx_bufs[rx_next_idx], sizeof(rx_bufs[0]));
+            rx_next_idx ^= 1;
+            break;
+        }
+        case UART_RX_STOPPED:{
+            stats.rx_errors++;
+            break;
+        }
+        case UART_RX_DISABLED:{
+            // restart reception after line errors
+            uart_rx_enable(dev, rx_bufs[rx_next_idx], sizeof(rx_bufs[0]), UART_STREAM_RX_TIMEOUT_US);
+            rx_next_idx ^= 1;
+            break;
+        }
+        default:{
+            break;
+        }
+    }
+}
+
+// Address payload: type (1) + address (6), little endian like bt_addr_t
+#define ADDR_PAYLOAD_LEN                    (1 + sizeof(bt_addr_t))
+
+static void read_addr_payload(const uint8_t *payload, bt_addr_le_t *addr)
+{
+    addr->type = payload[0];
+    memcpy(addr->a.val, &payload[1], sizeof(addr->a.val));
+}
+
+static int handle_cmd(uint8_t type, const uint8_t *payload, size_t len)
+{
+    switch(type){
+        case UART_STREAM_CMD_PING:{
+            send_stats();
+            return 0;
+        }
+        case UART_STREAM_CMD_ADD_ADDR:{
+            bt_addr_le_t addr;
+            uint8_t group = 0;
+
+            // optional trailing access rule group, group 0 if missing
+            if(len != ADDR_PAYLOAD_LEN && len != ADDR_PAYLOAD_LEN + 1){
+                return -EINVAL;
+            }
+
+            read_addr_payload(payload, &addr);
+            if(len == ADDR_PAYLOAD_LEN + 1){
+                group = payload[ADDR_PAYLOAD_LEN];
+            }
+            // the ack carries -ENOMEM when the filter is full
+            return ble_add_addr_to_filter(&addr, group);
+        }
+        case UART_STREAM_CMD_REMOVE_ADDR:{
+            bt_addr_le_t addr;
+
+            if(len != ADDR_PAYLOAD_LEN){
+                return -EINVAL;
+            }
+
+            read_addr_payload(payload, &addr);
+            return ble_remove_addr_from_filter(&addr);
+        }
+        case UART_STREAM_CMD_CLEAR_ADDRS:{
+            ble_clear_filter();
+            return 0;
+        }
+        case UART_STREAM_CMD_SET_LIGHT_TIMEOUT:{
+            if(len != 2){
+                return -EINVAL;
+            }
+
+            struct output_msg msg = {
+                .type = OUTPUT_MSG_TYPE_SET_OVERHEAD_LIGHT_TIMEOUT,
+                .state = sys_get_le16(payload)
+            };
+
+            return output_post(&msg);
+        }
+        case UART_STREAM_CMD_RULES_BEGIN:{
+            if(len != 2){
+                return -EINVAL;
+            }
+
+            return rules_begin(sys_get_le16(payload));
+        }
+        case UART_STREAM_CMD_RULES_SCHEDULE:{
+            if(len != 4){
+                return -EINVAL;
+            }
+
+            return rules_add_schedule_range(payload[0], payload[1], payload[2], payload[3]);
+        }
+        case UART_STREAM_CMD_RULES_GROUP:{
+            if(len != 6){
+                return -EINVAL;
+            }
+
+            return rules_set_group(payload[0], payload[1], sys_get_le32(&payload[2]));
+        }
+        case UART_STREAM_CMD_RULES_HOLIDAY:{
+            if(len != 2){
+                return -EINVAL;
+            }
+
+            return rules_add_holiday(sys_get_le16(payload));
+        }
+        case UART_STREAM_CMD_RULES_COMMIT:{
+            return rules_commit();
+        }
+        case UART_STREAM_CMD_SET_TIME:{
+            if(len != 4){
+                return -EINVAL;
+            }
+
+            rules_set_time(sys_get_le32(payload));
+            return 0;
+        }
+        default:{
+            return -ENOTSUP;
+        }
+    }
+}
+
+static void process_frame(const struct rx_frame *rx)
+{
+    uint8_t frame[UART_STREAM_MAX_FRAME_LEN];
+
+    int len = cobs_decode(rx->data, rx->len, frame, sizeof(frame));
+    if(len < UART_STREAM_HDR_LEN + UART_STREAM_CRC_LEN){
+        stats.rx_errors++;
+        return;
+    }
+
+    len -= UART_STREAM_CRC_LEN;
+    if(crc16_itu_t(0xffff, frame, len) != sys_get_le16(&frame[len])){
+        LOG_WRN("Stream frame CRC error");
+        stats.rx_errors++;
+        return;
+    }
+
+    stats.rx_frames++;
+
+    uint16_t seq = sys_get_le16(&frame[1]);
+    int res = handle_cmd(frame[0], &frame[UART_STREAM_HDR_LEN], len - UART_STREAM_HDR_LEN);
+    LOG_DBG("Stream command 0x%02x (seq %d) result %d", frame[0], seq, res);
+    send_ack(frame[0], seq, res);
+}
+
+void uart_stream_thread_main()
+{
+    LOG_DBG("Start uart stream thread");
+    int res = 0;
+
+    if(!device_is_ready(stream_uart)){
+        LOG_ERR("Stream uart not ready");
+        return;
+    }
+
+    res = uart_callback_set(stream_uart, uart_cb, NULL);
+    if(res){
+        LOG_ERR("Stream uart callback set fail (err %d)", res);
+        return;
+    }
+
+    res = uart_rx_enable(stream_uart, rx_bufs[0], sizeof(rx_bufs[0]), UART_STREAM_RX_TIMEOUT_US);
+    if(res){
+        LOG_ERR("Stream uart rx enable fail (err %d)", res);
+        return;
+    }
+    rx_next_idx = 1;
+
+    // flush frames queued before the uart was ready
+    k_spinlock_key_t key = k_spin_lock(&tx_lock);
+    stream_ready = true;
+    start_tx_locked();
+    k_spin_unlock(&tx_lock, key);
+
+    LOG_INF("Uart stream started");
+
+    struct rx_frame rx;
+    while(1){
+        k_msgq_get(&uart_stream_cmd_msgq, &rx, K_FOREVER);
+        process_frame(&rx);
+    }
+}
+
+K_THREAD_DEFINE(uart_stream_thread, CONFIG_APP_UART_STREAM_THREAD_STACK_SIZE, uart_stream_thread_main, NULL, NULL, NULL,
+    CONFIG_APP_UART_STREAM_THREAD_PRIORITY, 0, 0);
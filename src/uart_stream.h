@@ -0,0 +1,78 @@
+#ifndef UART_STREAM_H
+#define UART_STREAM_H
+
+#include "main.h"
+#include <zephyr/bluetooth/addr.h>
+
+/*
+ * Frame layout before COBS encoding (all fields little endian):
+ *
+ *   | type (1) | seq (2) | timestamp ms (4) | payload (0..32) | crc16 (2) |
+ *
+ * crc16 is CRC-16/CCITT-FALSE (poly 0x1021, seed 0xffff) over type..payload.
+ * Encoded frames are terminated by a single 0x00 byte.
+ */
+#define UART_STREAM_HDR_LEN                 7
+#define UART_STREAM_CRC_LEN                 2
+#define UART_STREAM_MAX_PAYLOAD_LEN         32
+#define UART_STREAM_MAX_FRAME_LEN           (UART_STREAM_HDR_LEN + UART_STREAM_MAX_PAYLOAD_LEN + UART_STREAM_CRC_LEN)
+// COBS overhead for frames < 254 bytes is one code byte, plus the delimiter
+#define UART_STREAM_MAX_ENCODED_LEN         (UART_STREAM_MAX_FRAME_LEN + 2)
+
+enum uart_stream_frame_types{
+    // reader -> gateway
+    UART_STREAM_EVT_PRESENCE = 0x01,
+    UART_STREAM_EVT_AUTH_STAGE = 0x02,
+    UART_STREAM_EVT_OUTPUT = 0x03,
+    UART_STREAM_EVT_STATS = 0x04,
+    UART_STREAM_EVT_ACK = 0x05,
+    UART_STREAM_EVT_BOOT_TIMING = 0x06,
+
+    // gateway -> reader
+    UART_STREAM_CMD_PING = 0x80,
+    UART_STREAM_CMD_ADD_ADDR = 0x81,
+    UART_STREAM_CMD_SET_LIGHT_TIMEOUT = 0x82,
+    UART_STREAM_CMD_RULES_BEGIN = 0x83,
+    UART_STREAM_CMD_RULES_SCHEDULE = 0x84,
+    UART_STREAM_CMD_RULES_GROUP = 0x85,
+    UART_STREAM_CMD_RULES_HOLIDAY = 0x86,
+    UART_STREAM_CMD_RULES_COMMIT = 0x87,
+    UART_STREAM_CMD_SET_TIME = 0x88,
+    UART_STREAM_CMD_REMOVE_ADDR = 0x89,
+    UART_STREAM_CMD_CLEAR_ADDRS = 0x8a,
+};
+
+#if defined(CONFIG_APP_UART_STREAM)
+
+/**
+ * @brief Queue a frame for transmission on the stream uart
+ *
+ * Safe to call from any context, including ISRs and BT callbacks.
+ *
+ * @param type frame type
+ * @param payload frame payload
+ * @param len payload length, at most UART_STREAM_MAX_PAYLOAD_LEN
+ * @return 0 on success, -ENOMEM if the frame was dropped
+ */
+int uart_stream_send(uint8_t type, const uint8_t *payload, size_t len);
+
+void uart_stream_presence(const bt_addr_le_t *addr, int8_t rssi);
+void uart_stream_auth_stage(int stage, uint32_t duration_ms, int err);
+void uart_stream_output_changed(int door, int type, int state);
+void uart_stream_boot_timing(int milestone, uint32_t uptime_ms);
+
+#else
+
+static inline int uart_stream_send(uint8_t type, const uint8_t *payload, size_t len)
+{
+    return 0;
+}
+
+static inline void uart_stream_presence(const bt_addr_le_t *addr, int8_t rssi) {}
+static inline void uart_stream_auth_stage(int stage, uint32_t duration_ms, int err) {}
+static inline void uart_stream_output_changed(int door, int type, int state) {}
+static inline void uart_stream_boot_timing(int milestone, uint32_t uptime_ms) {}
+
+#endif
+
+#endif
@@ -0,0 +1,29 @@
+#include "workq.h"
+
+#include <zephyr/init.h>
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(WORKQ);
+
+K_THREAD_STACK_DEFINE(app_workq_stack, CONFIG_APP_WORKQUEUE_STACK_SIZE);
+
+struct k_work_q app_workq;
+
+static int app_workq_init(const struct device *dev)
+{
+    ARG_UNUSED(dev);
+
+    struct k_work_queue_config cfg = {
+        .name = "app_workq",
+        .no_yield = false,
+    };
+
+    k_work_queue_start(&app_workq, app_workq_stack, K_THREAD_STACK_SIZEOF(app_workq_stack),
+        CONFIG_APP_WORKQUEUE_PRIORITY, &cfg);
+
+    LOG_DBG("App workqueue started");
+    return 0;
+}
+
+// Started before the modules that submit to it
+SYS_INIT(app_workq_init, POST_KERNEL, 0);
@@ -0,0 +1,9 @@
+#ifndef WORKQ_H
+#define WORKQ_H
+
+#include "main.h"
+
+// Shared workqueue for output, storage and BLE control (CONFIG_APP_WORKQUEUE)
+extern struct k_work_q app_workq;
+
+#endif
@@ -0,0 +1,197 @@
+/*
+ * Advertisement flood generator for the BLE access control scan path.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/random/rand32.h>
+#include <zephyr/bluetooth/bluetooth.h>
+
+#if defined(CONFIG_ARCH_POSIX)
+#include "bs_types.h"
+#include "bsim_args_runner.h"
+#endif
+
+LOG_MODULE_REGISTER(FLOOD);
+
+struct flood_set{
+    struct bt_le_ext_adv *adv;
+    int id;
+    bool allowlisted;
+};
+
+static const struct bt_data ad[] = {
+    BT_DATA_BYTES(BT_DATA_FLAGS, BT_LE_AD_NO_BREDR),
+    BT_DATA_BYTES(BT_DATA_MANUFACTURER_DATA, 0x59, 0x00, 0x02, 0x15),
+};
+
+static struct flood_set sets[CONFIG_FLOOD_ADV_SETS];
+static uint8_t device_nbr;
+static uint16_t rotation;
+static uint32_t adv_events;
+// allowlist entries used in this and the previous rotation, never reused
+// back to back so the reader sees a gap between two advertisers
+static uint32_t entries_in_use;
+static uint32_t entries_prev;
+
+// Pick a free allowlist entry owned by this device, -1 if there is none
+static int pick_entry()
+{
+    int owner = (device_nbr + CONFIG_FLOOD_DEVICES - 1) % CONFIG_FLOOD_DEVICES;
+    int candidates[CONFIG_FLOOD_ALLOWLIST_LEN];
+    int count = 0;
+
+    for(int entry=owner; entry<CONFIG_FLOOD_ALLOWLIST_LEN; entry+=CONFIG_FLOOD_DEVICES){
+        if(!((entries_in_use | entries_prev) & BIT(entry))){
+            candidates[count++] = entry;
+        }
+    }
+
+    return count ? candidates[sys_rand32_get() % count] : -1;
+}
+
+static void next_addr(struct flood_set *set, int idx, bt_addr_le_t *addr)
+{
+    int entry = -1;
+    if((sys_rand32_get() % 100) < CONFIG_FLOOD_ALLOWLISTED_PERCENT){
+        entry = pick_entry();
+    }
+    set->allowlisted = entry >= 0;
+
+    addr->type = BT_ADDR_LE_RANDOM;
+    if(set->allowlisted){
+        // matches the reader's CONFIG_APP_SCAN_STATS_ALLOWLIST_LEN entries
+        uint8_t val[] = {entry, 0x00, 0x00, 0x00, 0xde, 0xc0};
+        memcpy(addr->a.val, val, sizeof(val));
+        entries_in_use |= BIT(entry);
+        return;
+    }
+
+    uint8_t val[] = {rotation & 0xff, rotation >> 8, idx, device_nbr, 0x00, 0xc1};
+    memcpy(addr->a.val, val, sizeof(val));
+}
+
+static int start_set(struct flood_set *set, int idx)
+{
+    bt_addr_le_t addr;
+    char addr_str[BT_ADDR_LE_STR_LEN];
+    int res;
+
+    next_addr(set, idx, &addr);
+
+    if(set->id < 0){
+        res = bt_id_create(&addr, NULL);
+        if(res < 0){
+            return res;
+        }
+        set->id = res;
+    }
+    else{
+        res = bt_id_reset(set->id, &addr, NULL);
+        if(res < 0){
+            return res;
+        }
+    }
+
+    struct bt_le_adv_param param = BT_LE_ADV_PARAM_INIT(BT_LE_ADV_OPT_USE_IDENTITY,
+        BT_GAP_MS_TO_ADV_INTERVAL(CONFIG_FLOOD_ADV_INTERVAL_MS),
+        BT_GAP_MS_TO_ADV_INTERVAL(CONFIG_FLOOD_ADV_INTERVAL_MS), NULL);
+    param.id = set->id;
+
+    if(set->adv != NULL){
+        // the set's random address is only written when its parameters are
+        // set, bt_le_ext_adv_start() alone would keep the old identity
+        res = bt_le_ext_adv_update_param(set->adv, &param);
+        if(res){
+            return res;
+        }
+    }
+    else{
+        res = bt_le_ext_adv_create(&param, NULL, &set->adv);
+        if(res){
+            return res;
+        }
+
+        res = bt_le_ext_adv_set_data(set->adv, ad, ARRAY_SIZE(ad), NULL, 0);
+        if(res){
+            return res;
+        }
+    }
+
+    res = bt_le_ext_adv_start(set->adv, BT_LE_EXT_ADV_START_DEFAULT);
+    if(res){
+        return res;
+    }
+
+    if(set->allowlisted){
+        bt_addr_le_to_str(&addr, addr_str, sizeof(addr_str));
+        LOG_INF("Allowlisted adv %s start at %llu us", addr_str, k_ticks_to_us_floor64(k_uptime_ticks()));
+    }
+
+    return 0;
+}
+
+void main(void)
+{
+    int res;
+
+#if defined(CONFIG_ARCH_POSIX)
+    device_nbr = bsim_args_get_global_device_nbr();
+#endif
+
+    res = bt_enable(NULL);
+    if(res){
+        LOG_ERR("BLE enable fail (err %d)", res);
+        return;
+    }
+
+    for(int i=0; i<ARRAY_SIZE(sets); ++i){
+        sets[i].id = -1;
+        res = start_set(&sets[i], i);
+        if(res){
+            LOG_ERR("Adv set %d start fail (err %d)", i, res);
+            return;
+        }
+    }
+
+    LOG_INF("Flooding with %d sets, interval %d ms, rotation %d ms, %d%% allowlisted",
+        CONFIG_FLOOD_ADV_SETS, CONFIG_FLOOD_ADV_INTERVAL_MS, CONFIG_FLOOD_ROTATE_MS,
+        CONFIG_FLOOD_ALLOWLISTED_PERCENT);
+
+    int64_t last_report = k_uptime_get();
+    int64_t last_rotation = last_report;
+    int64_t last_events = last_report;
+    while(1){
+        k_sleep(K_MSEC(10));
+        int64_t now = k_uptime_get();
+
+        // each set sends one advertising event per interval, the 0-10 ms
+        // random advDelay makes this a slight overcount
+        uint32_t events = (now - last_events) / CONFIG_FLOOD_ADV_INTERVAL_MS;
+        if(events){
+            adv_events += events * CONFIG_FLOOD_ADV_SETS;
+            last_events += (int64_t)events * CONFIG_FLOOD_ADV_INTERVAL_MS;
+        }
+
+        if(CONFIG_FLOOD_ROTATE_MS && now - last_rotation >= CONFIG_FLOOD_ROTATE_MS){
+            rotation++;
+            entries_prev = entries_in_use;
+            entries_in_use = 0;
+            for(int i=0; i<ARRAY_SIZE(sets); ++i){
+                bt_le_ext_adv_stop(sets[i].adv);
+                res = start_set(&sets[i], i);
+                if(res){
+                    LOG_ERR("Adv set %d rotate fail (err %d)", i, res);
+                }
+            }
+            last_rotation = now;
+        }
+
+        if(now - last_report >= CONFIG_FLOOD_REPORT_INTERVAL_MS){
+            LOG_INF("flood: %u adv events sent", adv_events);
+            last_report = now;
+        }
+    }
+}
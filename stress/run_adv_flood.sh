@@ -0,0 +1,89 @@
+#!/usr/bin/env bash
+# SPDX-License-Identifier: Apache-2.0
+#
+# Run the reader against simulated advertisement floods in BabbleSim and
+# summarize the scan path numbers. See "Advertisement flood harness" in
+# README.rst.
+#
+# Needs ZEPHYR_BASE, BSIM_OUT_PATH and BSIM_COMPONENTS_PATH, and west.
+
+set -euo pipefail
+
+FLOOD_DEVICES=4
+SIM_SECONDS=30
+SETS=8
+INTERVAL_MS=100
+ROTATE_MS=1000
+ALLOWLISTED_PERCENT=10
+OUT=build_stress
+
+usage() {
+  echo "usage: $0 [-n flood_devices] [-t sim_seconds] [-s sets_per_device]" \
+       "[-i adv_interval_ms] [-r rotate_ms] [-a allowlisted_percent] [-o out_dir]"
+  exit 1
+}
+
+while getopts "n:t:s:i:r:a:o:h" opt; do
+  case $opt in
+    n) FLOOD_DEVICES=$OPTARG ;;
+    t) SIM_SECONDS=$OPTARG ;;
+    s) SETS=$OPTARG ;;
+    i) INTERVAL_MS=$OPTARG ;;
+    r) ROTATE_MS=$OPTARG ;;
+    a) ALLOWLISTED_PERCENT=$OPTARG ;;
+    o) OUT=$OPTARG ;;
+    *) usage ;;
+  esac
+done
+
+: "${ZEPHYR_BASE:?}" "${BSIM_OUT_PATH:?}" "${BSIM_COMPONENTS_PATH:?}"
+
+# a tag gone for half a rotation is a new advertiser when it comes back,
+# the flood never reuses an allowlisted address in consecutive rotations
+TAG_GAP_MS=500
+if ((ROTATE_MS > 0)); then
+  TAG_GAP_MS=$((ROTATE_MS / 2))
+fi
+if ((ROTATE_MS > 0 && TAG_GAP_MS <= 2 * INTERVAL_MS)); then
+  echo "rotation must be well above the advertising interval to match sightings" >&2
+  exit 1
+fi
+
+APP_DIR=$(cd "$(dirname "$0")/.." && pwd)
+SIM_ID=ble_ac_flood_$$
+LOGS=$OUT/logs
+mkdir -p "$LOGS"
+
+west build -p auto -b nrf52_bsim -d "$OUT/reader" "$APP_DIR" -- \
+  -DOVERLAY_CONFIG="$APP_DIR/stress/reader_stress.conf" \
+  -DCONFIG_APP_SCAN_STATS_TAG_GAP_MS="$TAG_GAP_MS"
+
+west build -p auto -b nrf52_bsim -d "$OUT/flood" "$APP_DIR/stress/adv_flood" -- \
+  -DCONFIG_FLOOD_ADV_SETS="$SETS" \
+  -DCONFIG_FLOOD_ADV_INTERVAL_MS="$INTERVAL_MS" \
+  -DCONFIG_FLOOD_ROTATE_MS="$ROTATE_MS" \
+  -DCONFIG_FLOOD_ALLOWLISTED_PERCENT="$ALLOWLISTED_PERCENT" \
+  -DCONFIG_FLOOD_DEVICES="$FLOOD_DEVICES"
+
+READER_EXE=$OUT/reader/zephyr/zephyr.exe
+FLOOD_EXE=$OUT/flood/zephyr/zephyr.exe
+SIM_LENGTH_US=$((SIM_SECONDS * 1000000))
+
+# device 0 is the reader, its host CPU time is recorded separately
+/usr/bin/time -f "%U %S" -o "$LOGS/reader.time" \
+  "$READER_EXE" -s="$SIM_ID" -d=0 -rs=1 > "$LOGS/reader.log" 2>&1 &
+pids=($!)
+
+for ((i = 1; i <= FLOOD_DEVICES; i++)); do
+  "$FLOOD_EXE" -s="$SIM_ID" -d="$i" -rs=$((i + 100)) > "$LOGS/flood_$i.log" 2>&1 &
+  pids+=($!)
+done
+
+(cd "$BSIM_OUT_PATH/bin" && ./bs_2G4_phy_v1 -s="$SIM_ID" -D=$((FLOOD_DEVICES + 1)) \
+  -sim_length="$SIM_LENGTH_US") > "$LOGS/phy.log" 2>&1
+
+wait "${pids[@]}" || true
+
+python3 "$APP_DIR/stress/summarize.py" --sim-seconds "$SIM_SECONDS" \
+  --devices "$FLOOD_DEVICES" --sets "$SETS" --interval-ms "$INTERVAL_MS" \
+  --rotate-ms "$ROTATE_MS" "$LOGS"
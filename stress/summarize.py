@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+"""Summarize an advertisement flood run from stress/run_adv_flood.sh logs."""
+
+import argparse
+import glob
+import os
+import re
+
+# idle scan parameters in src/ble.c scan continuously, without duplicate filtering
+SCAN_DUTY = 1.0
+
+SCAN_RE = re.compile(r"scan: (\d+) adv/s (\d+) allowlisted/s (\d+) presence/s load (\d+)\.(\d)%"
+                     r" \(total adv (\d+) allowlisted (\d+) presence (\d+)\)")
+SIGHTING_RE = re.compile(r"Tag (.+?) seen at (\d+) us, presence handled at (\d+) us")
+FIRST_SCAN_RE = re.compile(r"Boot to first scan: (\d+) ms")
+BOOT_RE = re.compile(r"Boot to (.+?): (\d+) ms")
+FLOOD_START_RE = re.compile(r"Allowlisted adv (.+?) start at (\d+) us")
+FLOOD_SENT_RE = re.compile(r"flood: (\d+) adv events sent")
+
+
+def read(path):
+    with open(path, errors="replace") as f:
+        return f.read()
+
+
+def percentile(values, pct):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * pct / 100))]
+
+
+def print_distribution(label, values_us):
+    ms = [v / 1000 for v in values_us]
+    print("%s n %d, min %.1f, p50 %.1f, p90 %.1f, p99 %.1f, max %.1f ms" %
+          (label, len(ms), min(ms), percentile(ms, 50), percentile(ms, 90), percentile(ms, 99), max(ms)))
+
+
+def match_sightings(starts, sightings):
+    """Pair each advertiser start with the first reader sighting of its address after it.
+
+    starts and sightings are sorted lists of (addr, start_us) and
+    (addr, seen_us, handled_us). The flood never shares an allowlisted
+    address between live advertisers, so a sighting belongs to the latest
+    start of its address before it.
+    """
+    by_addr = {}
+    for addr, seen, handled in sightings:
+        by_addr.setdefault(addr, []).append((seen, handled))
+
+    matched = []
+    missed = 0
+    for i, (addr, start) in enumerate(starts):
+        # the next start of the same address ends this advertiser
+        end = next((s for a, s in starts[i + 1:] if a == addr), None)
+        hit = next(((seen, handled) for seen, handled in by_addr.get(addr, [])
+                    if seen >= start and (end is None or seen < end)), None)
+        if hit is None:
+            missed += 1
+            continue
+        matched.append((hit[0] - start, hit[1] - start))
+    return matched, missed
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("logs")
+    parser.add_argument("--sim-seconds", type=float, required=True)
+    parser.add_argument("--devices", type=int, required=True)
+    parser.add_argument("--sets", type=int, required=True)
+    parser.add_argument("--interval-ms", type=int, required=True)
+    parser.add_argument("--rotate-ms", type=int, required=True)
+    args = parser.parse_args()
+
+    reader = read(os.path.join(args.logs, "reader.log"))
+    scans = [tuple(int(x) for x in m.groups()) for m in SCAN_RE.finditer(reader)]
+    if not scans:
+        raise SystemExit("no scan stats in reader.log")
+
+    # skip the first report, it covers controller start up
+    steady = scans[1:] or scans
+    rates = [s[0] for s in steady]
+    total_adv = scans[-1][5]
+
+    sent = 0
+    starts = []
+    for path in glob.glob(os.path.join(args.logs, "flood_*.log")):
+        log = read(path)
+        counts = [int(m.group(1)) for m in FLOOD_SENT_RE.finditer(log)]
+        sent += counts[-1] if counts else 0
+        starts += [(m.group(1), int(m.group(2))) for m in FLOOD_START_RE.finditer(log)]
+
+    advertisers = args.devices * args.sets
+    if args.rotate_ms:
+        advertisers = int(advertisers * args.sim_seconds * 1000 / args.rotate_ms)
+
+    print("advertisers simulated:      %d (%d concurrent)" % (advertisers, args.devices * args.sets))
+    print("device_found() callbacks/s: mean %.0f, max %d" % (sum(rates) / len(rates), max(rates)))
+    print("allowlisted callbacks/s:    mean %.0f" % (sum(s[1] for s in steady) / len(steady)))
+    print("presence events/s (main):   mean %.1f" % (sum(s[2] for s in steady) / len(steady)))
+
+    if sent:
+        expected = sent * SCAN_DUTY
+        drop = max(0.0, 1 - total_adv / expected)
+        print("adv events sent:            %d, expected in scan windows %.0f" % (sent, expected))
+        # BabbleSim models collisions between the simulated advertisers, so
+        # this is on-air loss plus controller/HCI loss
+        print("total adv loss (air + controller/HCI): %.1f%%" % (drop * 100))
+
+    # simulated uptime: controller and radio timing is modelled, CPU time is not
+    for m in BOOT_RE.finditer(reader):
+        print("boot to %-25s %s ms" % (m.group(1) + ":", m.group(2)))
+
+    time_path = os.path.join(args.logs, "reader.time")
+    if os.path.exists(time_path):
+        user, system = (float(x) for x in read(time_path).split()[-2:])
+        print("host CPU per sim second:    %.3f s" % ((user + system) / args.sim_seconds))
+
+    # advertisers started before the reader scanned would count boot time
+    first_scan = FIRST_SCAN_RE.search(reader)
+    if first_scan:
+        scan_us = int(first_scan.group(1)) * 1000
+        starts = [s for s in starts if s[1] >= scan_us]
+    sightings = sorted((m.group(1), int(m.group(2)), int(m.group(3))) for m in SIGHTING_RE.finditer(reader))
+    matched, missed = match_sightings(sorted(starts, key=lambda s: s[1]), sightings)
+
+    print("allowlisted advertisers:    %d after first scan, %d seen, %d never seen" %
+          (len(starts), len(matched), missed))
+    if starts and missed > len(starts) / 2:
+        print("warning: most allowlisted advertisers were never seen, check that the"
+              " flood's address rotation reaches the air")
+    if matched:
+        print_distribution("tag adv -> device_found():", [m[0] for m in matched])
+        print_distribution("tag adv -> MAIN_EVT_BLE_DEVICE_FOUND handled:", [m[1] for m in matched])
+
+
+if __name__ == "__main__":
+    main()